@@ -0,0 +1,133 @@
+/*
+* Benchmark runner, see BenchmarkSuite.h.
+* Usage: search_list_bench [--documents N] [--dictionary N] [--queries N] [--repetitions N] [--seed N]
+*                          [--filter NAME] [--json FILE] [--comparisons]
+* --json writes the results as JSON to FILE, or to the standard output for "-".
+* --comparisons also runs the old-against-new benchmarks of BenchmarkSearchServer.h, a failed result check makes the exit code 1
+* Built with SEARCH_LIST_PROFILING, the runner ends with the profile of the server's scopes.
+*/
+
+#include <cstdlib>
+#include <fstream>
+#include <new>
+
+#include "SearchServer.h"
+#include "logtime.h"
+#include "ProcessQueries.h"
+#include "TestProcessQueries.h"
+#include "BenchmarkSuite.h"
+#include "BenchmarkSearchServer.h"
+
+using namespace std;
+
+// Counts the allocations for BenchmarkQueryAllocations()
+void* operator new(size_t size) {
+    ++benchmark_allocation_count;
+    if (void* memory = malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkConfig config;
+    string name_filter;
+    string json_path;
+    bool run_comparisons = false;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const string_view option = argv[i];
+            if (option == "--comparisons"sv) {
+                run_comparisons = true;
+                continue;
+            }
+            if (i + 1 == argc) {
+                throw invalid_argument("Missing value of "s + string(option));
+            }
+            const string value = argv[++i];
+            if (option == "--documents"sv) {
+                config.document_count = stoi(value);
+            }
+            else if (option == "--dictionary"sv) {
+                config.dictionary_size = stoi(value);
+            }
+            else if (option == "--queries"sv) {
+                config.query_count = stoi(value);
+            }
+            else if (option == "--repetitions"sv) {
+                config.repetitions = stoi(value);
+            }
+            else if (option == "--seed"sv) {
+                config.seed = static_cast<uint32_t>(stoul(value));
+            }
+            else if (option == "--filter"sv) {
+                name_filter = value;
+            }
+            else if (option == "--json"sv) {
+                json_path = value;
+            }
+            else {
+                throw invalid_argument("Unknown option "s + string(option));
+            }
+        }
+
+        const auto results = RunBenchmarkSuite(config, name_filter, cerr);
+        PrintBenchmarkResults(results, cerr);
+        if (json_path == "-"s) {
+            WriteBenchmarkJson(config, results, cout);
+        }
+        else if (!json_path.empty()) {
+            ofstream json_file(json_path);
+            WriteBenchmarkJson(config, results, json_file);
+            if (!json_file) {
+                throw runtime_error("Cannot write "s + json_path);
+            }
+        }
+    }
+    catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    if (run_comparisons) {
+        const vector<pair<string, void (*)()>> comparisons = {
+            { "BenchmarkIndexLayout"s, BenchmarkIndexLayout },
+            { "BenchmarkBulkLoad"s, BenchmarkBulkLoad },
+            { "BenchmarkSnapshotStartup"s, BenchmarkSnapshotStartup },
+            { "BenchmarkPostingCompression"s, BenchmarkPostingCompression },
+            { "BenchmarkTextScan"s, BenchmarkTextScan },
+            { "BenchmarkMinusWords"s, BenchmarkMinusWords },
+            { "BenchmarkStatusFilter"s, BenchmarkStatusFilter },
+            { "BenchmarkMaxScoreEngine"s, BenchmarkMaxScoreEngine },
+            { "BenchmarkConcurrentIngest"s, BenchmarkConcurrentIngest },
+            { "BenchmarkShardedSearch"s, BenchmarkShardedSearch },
+            { "BenchmarkQueryExecutor"s, BenchmarkQueryExecutor },
+            { "BenchmarkDeepPagination"s, BenchmarkDeepPagination },
+            { "BenchmarkPhraseQueries"s, BenchmarkPhraseQueries },
+            { "BenchmarkQueryAllocations"s, BenchmarkQueryAllocations },
+        };
+        for (const auto& [name, benchmark] : comparisons) {
+            if (name.find(name_filter) != string::npos) {
+                cerr << name << endl;
+                benchmark();
+            }
+        }
+    }
+#ifdef SEARCH_LIST_PROFILING
+    profiling::PrintProfileReport(cerr);
+#endif
+    if (benchmark_check_failures > 0) {
+        cerr << benchmark_check_failures << " comparison checks failed"s << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,701 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+
+#include "SearchServer.h"
+#include "MappedSearchServer.h"
+#include "ConcurrentSearchServer.h"
+#include "ShardedSearchServer.h"
+#include "QueryExecutor.h"
+#include "TestProcessQueries.h"
+
+// Result checks of the comparisons. Unlike assert they stay in Release builds: a failed check is reported
+// and the runner carries on with the other comparisons, then exits with an error
+inline size_t benchmark_check_failures = 0;
+
+template <typename T, typename U>
+void CheckBenchmarkEqual(const T& t, const U& u, const string& t_str, const string& u_str, const string& func, unsigned line) {
+    if (t != u) {
+        cerr << func << "("s << line << "): check "s << t_str << " == "s << u_str << " failed: "s << t << " != "s << u << endl;
+        ++benchmark_check_failures;
+    }
+}
+
+void CheckBenchmark(bool value, const string& value_str, const string& func, unsigned line) {
+    if (!value) {
+        cerr << func << "("s << line << "): check "s << value_str << " failed"s << endl;
+        ++benchmark_check_failures;
+    }
+}
+
+#define BENCHMARK_CHECK_EQUAL(a, b) CheckBenchmarkEqual((a), (b), #a, #b, __FUNCTION__, __LINE__)
+
+#define BENCHMARK_CHECK(a) CheckBenchmark((a), #a, __FUNCTION__, __LINE__)
+
+// The index layout SearchServer used before term interning: one tree node per word and per posting.
+// Kept only as a baseline for BenchmarkIndexLayout().
+class MapIndexSearchServer {
+public:
+    void AddDocument(int document_id, const string& document, DocumentStatus status, const vector<int>& ratings) {
+        const auto words = SplitIntoWords(document);
+        const double inv_word_count = 1.0 / words.size();
+        for (const string_view word : words) {
+            word_to_document_freqs_[string(word)][document_id] += inv_word_count;
+        }
+        const int rating = ratings.empty() ? 0 : accumulate(ratings.begin(), ratings.end(), 0) / static_cast<int>(ratings.size());
+        documents_.emplace(document_id, DocumentData{ rating, status });
+    }
+
+    vector<Document> FindTopDocuments(const string& raw_query) const {
+        set<string> plus_words;
+        set<string> minus_words;
+        for (const string_view word : SplitIntoWords(raw_query)) {
+            if (word[0] == '-') {
+                minus_words.emplace(word.substr(1));
+            }
+            else {
+                plus_words.emplace(word);
+            }
+        }
+
+        map<int, double> document_to_relevance;
+        for (const string& word : plus_words) {
+            if (word_to_document_freqs_.count(word) == 0) {
+                continue;
+            }
+            const double inverse_document_freq = log(documents_.size() * 1.0 / word_to_document_freqs_.at(word).size());
+            for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
+                if (documents_.at(document_id).status == DocumentStatus::ACTUAL) {
+                    document_to_relevance[document_id] += term_freq * inverse_document_freq;
+                }
+            }
+        }
+        for (const string& word : minus_words) {
+            if (word_to_document_freqs_.count(word) == 0) {
+                continue;
+            }
+            for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
+                document_to_relevance.erase(document_id);
+            }
+        }
+
+        vector<Document> matched_documents;
+        for (const auto [document_id, relevance] : document_to_relevance) {
+            matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
+        }
+        sort(matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
+            if (abs(lhs.relevance - rhs.relevance) < 1e-6) {
+                return lhs.rating > rhs.rating;
+            }
+            return lhs.relevance > rhs.relevance;
+            });
+        if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
+            matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+        }
+        return matched_documents;
+    }
+
+private:
+    struct DocumentData {
+        int rating;
+        DocumentStatus status;
+    };
+    map<string, map<int, double>> word_to_document_freqs_;
+    map<int, DocumentData> documents_;
+};
+
+// Compares ingest and query time of the interned flat posting lists against the old nested maps
+void BenchmarkIndexLayout() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 10'000, 25);
+    const auto documents = GenerateQueries(generator, dictionary, 100'000, 70);
+    const auto queries = GenerateQueries(generator, dictionary, 2'000, 7);
+
+    MapIndexSearchServer map_server;
+    {
+        LOG_DURATION("map index: AddDocument"s);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            map_server.AddDocument(static_cast<int>(i), documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+    }
+    SearchServer search_server(""s);
+    {
+        LOG_DURATION("flat index: AddDocument"s);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            search_server.AddDocument(static_cast<int>(i), documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+    }
+
+    size_t map_found = 0;
+    {
+        LOG_DURATION("map index: FindTopDocuments"s);
+        for (const string& query : queries) {
+            map_found += map_server.FindTopDocuments(query).size();
+        }
+    }
+    size_t flat_found = 0;
+    {
+        LOG_DURATION("flat index: FindTopDocuments"s);
+        for (const string& query : queries) {
+            flat_found += search_server.FindTopDocuments(query).size();
+        }
+    }
+    BENCHMARK_CHECK_EQUAL(map_found, flat_found);
+}
+
+// Cold start: one AddDocument per document against a single AddDocuments batch
+void BenchmarkBulkLoad() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 10'000, 25);
+    const auto texts = GenerateQueries(generator, dictionary, 100'000, 70);
+    vector<DocumentInput> documents;
+    documents.reserve(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) {
+        documents.push_back({ static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, { 1, 2, 3 } });
+    }
+
+    SearchServer one_by_one(""s);
+    {
+        LOG_DURATION("AddDocument x "s + to_string(documents.size()));
+        for (const DocumentInput& document : documents) {
+            one_by_one.AddDocument(document.id, document.text, document.status, document.ratings);
+        }
+    }
+    SearchServer bulk(""s);
+    {
+        LOG_DURATION("AddDocuments(par)"s);
+        bulk.AddDocuments(execution::par, documents);
+    }
+    BENCHMARK_CHECK_EQUAL(one_by_one.GetDocumentCount(), bulk.GetDocumentCount());
+}
+
+// Startup: rebuilding the index from text against opening a snapshot of it
+void BenchmarkSnapshotStartup() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 10'000, 25);
+    const auto texts = GenerateQueries(generator, dictionary, 100'000, 70);
+    const auto queries = GenerateQueries(generator, dictionary, 100, 7);
+    vector<DocumentInput> documents;
+    documents.reserve(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) {
+        documents.push_back({ static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, { 1, 2, 3 } });
+    }
+    const string path = (filesystem::temp_directory_path() / "search_server_benchmark.snapshot"s).string();
+
+    size_t rebuilt_found = 0;
+    SearchServer search_server(""s);
+    {
+        LOG_DURATION("startup from text"s);
+        search_server.AddDocuments(documents);
+        for (const string& query : queries) {
+            rebuilt_found += search_server.FindTopDocuments(query).size();
+        }
+    }
+    {
+        LOG_DURATION("SaveSnapshot"s);
+        search_server.SaveSnapshot(path);
+    }
+    for (const auto verification : { SnapshotVerification::CHECKSUM, SnapshotVerification::HEADER_ONLY }) {
+        size_t mapped_found = 0;
+        {
+            LOG_DURATION(verification == SnapshotVerification::CHECKSUM ? "startup from snapshot"s : "startup from snapshot, no checksum"s);
+            const MappedSearchServer mapped_server(path, verification);
+            for (const string& query : queries) {
+                mapped_found += mapped_server.FindTopDocuments(query).size();
+            }
+        }
+        BENCHMARK_CHECK_EQUAL(mapped_found, rebuilt_found);
+    }
+    cerr << "snapshot size: "s << filesystem::file_size(path) / 1024 << " KiB"s << endl;
+    filesystem::remove(path);
+}
+
+// Size of plain and compressed snapshot postings and query time over them, on the corpus of Test4
+void BenchmarkPostingCompression() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 2'000, 25);
+    const auto documents = GenerateQueries(generator, dictionary, 20'000, 10);
+    const auto queries = GenerateQueries(generator, dictionary, 2'000, 7);
+
+    SearchServer search_server(dictionary[0]);
+    for (size_t i = 0; i < documents.size(); ++i) {
+        search_server.AddDocument(static_cast<int>(i), documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+    }
+    size_t expected_found = 0;
+    {
+        LOG_DURATION("SearchServer: FindTopDocuments"s);
+        for (const string& query : queries) {
+            expected_found += search_server.FindTopDocuments(query).size();
+        }
+    }
+
+    for (const auto encoding : { SnapshotPostingEncoding::PLAIN, SnapshotPostingEncoding::COMPRESSED }) {
+        const string name = encoding == SnapshotPostingEncoding::PLAIN ? "plain"s : "compressed"s;
+        const string path = (filesystem::temp_directory_path() / ("search_server_benchmark_"s + name + ".snapshot"s)).string();
+        search_server.SaveSnapshot(path, encoding);
+        {
+            const MappedSearchServer mapped_server(path);
+            const auto stats = mapped_server.GetPostingStorageStats();
+            cerr << name << " postings: "s << stats.posting_count << " postings, "s
+                << static_cast<double>(stats.bytes) / stats.posting_count << " bytes per posting"s << endl;
+            size_t found = 0;
+            {
+                LOG_DURATION(name + " snapshot: FindTopDocuments"s);
+                for (const string& query : queries) {
+                    found += mapped_server.FindTopDocuments(query).size();
+                }
+            }
+            BENCHMARK_CHECK_EQUAL(found, expected_found);
+        }
+        filesystem::remove(path);
+    }
+}
+
+// Tokenizer and word validation before the vectorized kernels. Kept only as a baseline for BenchmarkTextScan()
+void SplitIntoWordsWithFind(string_view str, vector<string_view>& result) {
+    result.clear();
+    const int64_t pos_end = str.npos;
+    while (true) {
+        int64_t space = str.find(' ');
+        result.push_back(space == pos_end ? str.substr(0) : str.substr(0, space));
+        if (space == pos_end) {
+            break;
+        }
+        else {
+            str.remove_prefix(space + 1);
+        }
+    }
+}
+
+bool IsValidWordByChar(string_view word) {
+    return none_of(word.begin(), word.end(), [](char c) {
+        return c >= '\0' && c < ' ';
+        });
+}
+
+// Splitting and validation of documents and queries: string_view::find and a per-character check
+// against the tokenizer, then the kernels alone on every instruction set the CPU supports
+void BenchmarkTextScan() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 10'000, 25);
+    const auto documents = GenerateQueries(generator, dictionary, 20'000, 70);
+    const auto queries = GenerateQueries(generator, dictionary, 200'000, 7);
+    const int repeat_count = 5;
+
+    vector<string_view> words;
+    for (const auto& [name, texts] : { pair{ "documents"s, &documents }, pair{ "queries"s, &queries } }) {
+        size_t expected_count = 0;
+        {
+            LOG_DURATION(name + ": find + per-character check"s);
+            for (int repeat = 0; repeat < repeat_count; ++repeat) {
+                for (const string& text : *texts) {
+                    SplitIntoWordsWithFind(text, words);
+                    expected_count += count_if(words.begin(), words.end(), IsValidWordByChar);
+                }
+            }
+        }
+        size_t count = 0;
+        {
+            LOG_DURATION(name + ": SplitIntoWords + HasControlCharacters"s);
+            for (int repeat = 0; repeat < repeat_count; ++repeat) {
+                for (const string& text : *texts) {
+                    SplitIntoWords(text, words);
+                    count += HasControlCharacters(text) ? 0 : words.size();
+                }
+            }
+        }
+        BENCHMARK_CHECK_EQUAL(count, expected_count);
+
+        vector<TextScanIsa> isas = { TextScanIsa::SCALAR };
+        if (GetBestTextScanIsa() != TextScanIsa::SCALAR) {
+            isas.push_back(TextScanIsa::SSE2);
+        }
+        if (GetBestTextScanIsa() == TextScanIsa::AVX2) {
+            isas.push_back(TextScanIsa::AVX2);
+        }
+        vector<uint64_t> space_bits;
+        for (const TextScanIsa isa : isas) {
+            const auto& kernels = GetTextScanKernels(isa);
+            const string isa_name = isa == TextScanIsa::SCALAR ? "scalar"s : isa == TextScanIsa::SSE2 ? "SSE2"s : "AVX2"s;
+            size_t count = 0;
+            {
+                LOG_DURATION(name + ": "s + isa_name + " kernels only"s);
+                for (int repeat = 0; repeat < repeat_count; ++repeat) {
+                    for (const string& text : *texts) {
+                        // Words are counted instead of collected
+                        space_bits.resize((text.size() + 63) / 64);
+                        kernels.mark_spaces(text.data(), text.size(), space_bits.data());
+                        size_t word_count = 1;
+                        for (const uint64_t bits : space_bits) {
+                            word_count += popcount(bits);
+                        }
+                        count += kernels.has_control_characters(text.data(), text.size()) ? 0 : word_count;
+                    }
+                }
+            }
+            BENCHMARK_CHECK_EQUAL(count, expected_count);
+        }
+    }
+}
+
+// Queries excluding a word that 90% of the documents contain
+void BenchmarkMinusWords() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 1'000, 10);
+    const auto texts = GenerateQueries(generator, dictionary, 200'000, 20);
+    const auto queries = GenerateQueries(generator, dictionary, 300, 3);
+    SearchServer search_server(""s);
+    for (size_t i = 0; i < texts.size(); ++i) {
+        search_server.AddDocument(static_cast<int>(i), i % 10 == 0 ? texts[i] : texts[i] + " the"s, DocumentStatus::ACTUAL, { 1 });
+    }
+
+    size_t found = 0;
+    {
+        LOG_DURATION("FindTopDocuments with -the"s);
+        for (const string& query : queries) {
+            found += search_server.FindTopDocuments(query + " -the"s).size();
+        }
+    }
+    {
+        LOG_DURATION("MatchDocument with -the"s);
+        for (int document_id = 0; document_id < 20'000; ++document_id) {
+            found += get<0>(search_server.MatchDocument(queries[document_id % queries.size()] + " -the"s, document_id)).size();
+        }
+    }
+    BENCHMARK_CHECK(found > 0);
+}
+
+// Status-only queries, which use the status bitmaps, against the same filter given as a predicate
+void BenchmarkStatusFilter() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 2'000, 10);
+    const auto texts = GenerateQueries(generator, dictionary, 200'000, 20);
+    const auto queries = GenerateQueries(generator, dictionary, 300, 3);
+    SearchServer search_server(""s);
+    for (size_t i = 0; i < texts.size(); ++i) {
+        search_server.AddDocument(static_cast<int>(i), texts[i], i % 5 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, { 1 });
+    }
+
+    for (const auto status : { DocumentStatus::ACTUAL, DocumentStatus::BANNED }) {
+        const string name = status == DocumentStatus::ACTUAL ? "ACTUAL (80%)"s : "BANNED (20%)"s;
+        size_t predicate_found = 0;
+        {
+            LOG_DURATION(name + " as predicate"s);
+            for (const string& query : queries) {
+                predicate_found += search_server.FindTopDocuments(query, [status](int document_id, DocumentStatus document_status, int rating) {
+                    return document_status == status;
+                    }).size();
+            }
+        }
+        size_t status_found = 0;
+        {
+            LOG_DURATION(name + " as status"s);
+            for (const string& query : queries) {
+                status_found += search_server.FindTopDocuments(query, status).size();
+            }
+        }
+        BENCHMARK_CHECK_EQUAL(predicate_found, status_found);
+    }
+}
+
+// Queries of 2-7 words over documents whose word frequencies fall off like in natural texts
+void BenchmarkMaxScoreEngine() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 20'000, 10);
+    const auto pick_word = [&]() -> const string& {
+        const double rank = exp(uniform_real_distribution(0.0, log(static_cast<double>(dictionary.size())))(generator)) - 1;
+        return dictionary[static_cast<size_t>(rank)];
+    };
+    SearchServer search_server(""s);
+    for (int id = 0; id < 200'000; ++id) {
+        string text = pick_word();
+        for (int i = 1; i < 20; ++i) {
+            text += " "s + pick_word();
+        }
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 10 });
+    }
+    vector<string> queries;
+    for (int i = 0; i < 100; ++i) {
+        string query = pick_word();
+        for (int j = uniform_int_distribution(1, 6)(generator); j > 0; --j) {
+            query += " "s + pick_word();
+        }
+        queries.push_back(move(query));
+    }
+
+    vector<vector<Document>> results;
+    {
+        LOG_DURATION("term at a time"s);
+        for (const string& query : queries) {
+            results.push_back(search_server.FindTopDocuments(query));
+        }
+    }
+    size_t mismatches = 0;
+    {
+        LOG_DURATION("max_score"s);
+        for (size_t i = 0; i < queries.size(); ++i) {
+            const auto documents = search_server.FindTopDocuments(query_engine::max_score, queries[i]);
+            mismatches += documents.size() != results[i].size() || !equal(documents.begin(), documents.end(), results[i].begin(),
+                [](const Document& lhs, const Document& rhs) { return lhs.id == rhs.id && lhs.relevance == rhs.relevance; });
+        }
+    }
+    BENCHMARK_CHECK_EQUAL(mismatches, 0u);
+}
+
+// Query latency while another thread adds documents: one server behind a mutex against snapshots
+void BenchmarkConcurrentIngest() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 5'000, 10);
+    const auto texts = GenerateQueries(generator, dictionary, 52'000, 20);
+    const auto queries = GenerateQueries(generator, dictionary, 100, 3);
+    SearchServer initial(""s);
+    for (int id = 0; id < 50'000; ++id) {
+        initial.AddDocument(id, texts[id], DocumentStatus::ACTUAL, { 1 });
+    }
+
+    const auto run = [&](const string& name, auto find, auto add) {
+        atomic<bool> is_done = false;
+        chrono::nanoseconds max_latency{ 0 };
+        size_t query_count = 0;
+        thread reader([&]() {
+            while (!is_done) {
+                const auto start_time = chrono::steady_clock::now();
+                find(queries[query_count++ % queries.size()]);
+                max_latency = max<chrono::nanoseconds>(max_latency, chrono::steady_clock::now() - start_time);
+            }
+            });
+        {
+            LOG_DURATION(name + " ingest"s);
+            for (int id = 50'000; id < 52'000; id += 100) {
+                vector<DocumentInput> documents;
+                for (int i = id; i < id + 100; ++i) {
+                    documents.push_back({ i, texts[i], DocumentStatus::ACTUAL, { 1 } });
+                }
+                add(documents);
+            }
+        }
+        is_done = true;
+        reader.join();
+        cerr << name << ": "s << query_count << " queries, max latency "s
+            << chrono::duration_cast<chrono::milliseconds>(max_latency).count() << " ms"s << endl;
+    };
+
+    {
+        SearchServer search_server(initial);
+        mutex server_mutex;
+        run("mutex"s, [&](const string& query) {
+            lock_guard guard(server_mutex);
+            return search_server.FindTopDocuments(query);
+            }, [&](const vector<DocumentInput>& documents) {
+                lock_guard guard(server_mutex);
+                search_server.AddDocuments(documents);
+            });
+    }
+    {
+        ConcurrentSearchServer search_server(initial);
+        run("snapshots"s, [&](const string& query) {
+            return search_server.FindTopDocuments(query);
+            }, [&](const vector<DocumentInput>& documents) {
+                search_server.AddDocuments(documents);
+            });
+        const auto stats = search_server.GetUpdateStats();
+        cerr << "snapshots: "s << stats.reused_versions << " versions replayed, "s << stats.copied_versions << " copied"s << endl;
+    }
+}
+
+// The same documents in one SearchServer and in sharded servers; the speedup grows with the number of cores
+void BenchmarkShardedSearch() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 10'000, 10);
+    const auto texts = GenerateQueries(generator, dictionary, 200'000, 20);
+    const auto queries = GenerateQueries(generator, dictionary, 1'000, 7);
+    size_t expected_found = 0;
+    {
+        SearchServer search_server(""s);
+        for (size_t i = 0; i < texts.size(); ++i) {
+            search_server.AddDocument(static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, { 1 });
+        }
+        LOG_DURATION("1 server"s);
+        for (const string& query : queries) {
+            expected_found += search_server.FindTopDocuments(query).size();
+        }
+    }
+    for (const size_t shard_count : { 2, 4, 8 }) {
+        ShardedSearchServer search_server(""s, shard_count);
+        for (size_t i = 0; i < texts.size(); ++i) {
+            search_server.AddDocument(static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, { 1 });
+        }
+        size_t found = 0;
+        {
+            LOG_DURATION(to_string(shard_count) + " shards"s);
+            for (const string& query : queries) {
+                found += search_server.FindTopDocuments(query).size();
+            }
+        }
+        BENCHMARK_CHECK_EQUAL(found, expected_found);
+    }
+}
+
+// Four clients with a batch each: sequential ProcessQueries against the shared query executor
+void BenchmarkQueryExecutor() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 2'000, 25);
+    const auto documents = GenerateQueries(generator, dictionary, 20'000, 10);
+    SearchServer search_server(dictionary[0]);
+    for (size_t i = 0; i < documents.size(); ++i) {
+        search_server.AddDocument(static_cast<int>(i), documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+    }
+    const auto queries = GenerateQueries(generator, dictionary, 2'000, 7);
+
+    const auto run_clients = [&](const string& name, auto process) {
+        LOG_DURATION(name);
+        vector<thread> clients;
+        for (int i = 0; i < 4; ++i) {
+            clients.emplace_back([&]() {
+                BENCHMARK_CHECK_EQUAL(process(queries).size(), queries.size());
+                });
+        }
+        for (thread& client : clients) {
+            client.join();
+        }
+    };
+    run_clients("ProcessQueries"s, [&](const vector<string>& batch) {
+        return ProcessQueries(search_server, batch);
+        });
+    QueryExecutor executor(search_server);
+    cerr << "QueryExecutor threads: "s << executor.GetThreadCount() << endl;
+    run_clients("QueryExecutor"s, [&](const vector<string>& batch) {
+        return executor.ProcessQueries(batch);
+        });
+}
+
+// Page 40 of 10 documents: the whole ranking paginated against one page after a cursor
+void BenchmarkDeepPagination() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 1'000, 10);
+    const auto texts = GenerateQueries(generator, dictionary, 100'000, 10);
+    const auto queries = GenerateQueries(generator, dictionary, 200, 3);
+    SearchServer search_server(""s);
+    for (size_t i = 0; i < texts.size(); ++i) {
+        search_server.AddDocument(static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, { static_cast<int>(i % 10) });
+    }
+    const size_t page_size = 10;
+    const size_t page_index = 39;
+
+    // Cursors of page 39, as a client paging through would have them
+    vector<optional<SearchCursor>> cursors;
+    for (const string& query : queries) {
+        optional<SearchCursor> cursor;
+        for (size_t i = 0; i < page_index && (i == 0 || cursor.has_value()); ++i) {
+            cursor = search_server.FindTopDocumentsPage(query, page_size, cursor).next_page;
+        }
+        cursors.push_back(cursor);
+    }
+
+    search_server.SetMaxResultDocumentCount(numeric_limits<int>::max());
+    vector<vector<int>> expected;
+    {
+        LOG_DURATION("full ranking and Paginate"s);
+        for (const string& query : queries) {
+            const auto documents = search_server.FindTopDocuments(query);
+            const auto pages = Paginate(documents, page_size);
+            vector<int> ids;
+            if (pages.size() > page_index) {
+                for (const Document& document : *next(pages.begin(), page_index)) {
+                    ids.push_back(document.id);
+                }
+            }
+            expected.push_back(move(ids));
+        }
+    }
+    size_t mismatches = 0;
+    {
+        LOG_DURATION("cursor"s);
+        for (size_t i = 0; i < queries.size(); ++i) {
+            vector<int> ids;
+            if (cursors[i].has_value()) {
+                for (const Document& document : search_server.FindTopDocumentsPage(queries[i], page_size, cursors[i]).documents) {
+                    ids.push_back(document.id);
+                }
+            }
+            mismatches += ids != expected[i];
+        }
+    }
+    BENCHMARK_CHECK_EQUAL(mismatches, 0u);
+}
+
+// Two-word phrases: the plain query filtered by scanning the matched texts, as done outside the server,
+// against the positional index
+void BenchmarkPhraseQueries() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 500, 10);
+    const auto texts = GenerateQueries(generator, dictionary, 50'000, 20);
+    vector<string> phrases;
+    for (int i = 0; i < 200; ++i) {
+        const auto words = SplitIntoWords(texts[uniform_int_distribution<size_t>(0, texts.size() - 1)(generator)]);
+        const size_t start = uniform_int_distribution<size_t>(0, words.size() - 1)(generator);
+        phrases.push_back(string(words[start]) + " "s + string(words[min(start + 1, words.size() - 1)]));
+    }
+    SearchServer search_server(""s);
+    search_server.EnablePositionalIndex();
+    for (size_t i = 0; i < texts.size(); ++i) {
+        search_server.AddDocument(static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, { 1 });
+    }
+    search_server.SetMaxResultDocumentCount(numeric_limits<int>::max());
+
+    vector<size_t> expected;
+    {
+        LOG_DURATION("post-filter"s);
+        for (const string& phrase : phrases) {
+            size_t found = 0;
+            for (const Document& document : search_server.FindTopDocuments(phrase)) {
+                found += (" "s + texts[document.id] + " "s).find(" "s + phrase + " "s) != string::npos;
+            }
+            expected.push_back(found);
+        }
+    }
+    size_t mismatches = 0;
+    {
+        LOG_DURATION("positional index"s);
+        for (size_t i = 0; i < phrases.size(); ++i) {
+            mismatches += search_server.FindTopDocuments("\""s + phrases[i] + "\""s).size() != expected[i];
+        }
+    }
+    BENCHMARK_CHECK_EQUAL(mismatches, 0u);
+}
+
+// Heap allocations of the runner, counted by its operator new in BenchmarkMain.cpp
+inline atomic<size_t> benchmark_allocation_count = 0;
+
+// A warmed-up query keeps its parsed words, minus word bitmaps and relevances in per-thread buffers,
+// so it allocates only its result vector
+void BenchmarkQueryAllocations() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 1'000, 10);
+    const auto texts = GenerateQueries(generator, dictionary, 20'000, 20);
+    const auto queries = GenerateQueries(generator, dictionary, 300, 3);
+    SearchServer search_server(""s);
+    for (size_t i = 0; i < texts.size(); ++i) {
+        search_server.AddDocument(static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, { 1 });
+    }
+    vector<string> all_queries = queries;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        all_queries.push_back(queries[i] + " -"s + dictionary[i % dictionary.size()]);
+    }
+
+    size_t allocations = 0;
+    size_t expected_allocations = 0;
+    {
+        LOG_DURATION("warmed-up FindTopDocuments"s);
+        for (const string& query : all_queries) {
+            search_server.FindTopDocuments(query);
+            const size_t before = benchmark_allocation_count;
+            const auto documents = search_server.FindTopDocuments(query);
+            allocations += benchmark_allocation_count - before;
+            expected_allocations += documents.empty() ? 0 : 1;
+        }
+    }
+    cerr << "allocations per query: "s << static_cast<double>(allocations) / all_queries.size() << endl;
+    BENCHMARK_CHECK_EQUAL(allocations, expected_allocations);
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "SearchServer.h"
+#include "ProcessQueries.h"
+#include "TestProcessQueries.h"
+
+// Reproducible benchmarks of the main operations. The corpus and the queries come from the Test4 generators
+// with a fixed seed, so every run measures the same work; every case is repeated and reported by
+// the median and the 99th percentile of its samples. A checksum of the results shows that runs did the same work
+
+struct BenchmarkConfig {
+    int document_count = 20'000;
+    int dictionary_size = 2'000;
+    int max_word_length = 25;
+    int max_document_words = 10;
+    int query_count = 2'000;
+    int max_query_words = 7;
+    int repetitions = 5;
+    uint32_t seed = mt19937::default_seed;
+};
+
+struct BenchmarkResult {
+    string name;
+    string unit;  // what one sample measures
+    int repetitions = 0;
+    size_t sample_count = 0;
+    double median_ns = 0.0;
+    double p99_ns = 0.0;
+    double mean_ns = 0.0;
+    double min_ns = 0.0;
+    double max_ns = 0.0;
+    double median_repetition_ms = 0.0;  // whole repetitions
+    uint64_t checksum = 0;
+};
+
+namespace benchmark_suite_detail {
+
+using Clock = chrono::steady_clock;
+
+inline double ToNanoseconds(Clock::duration duration) {
+    return static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(duration).count());
+}
+
+// Nearest-rank percentile of sorted samples, p in (0, 1]
+inline double GetPercentile(const vector<double>& sorted_samples, double p) {
+    const auto rank = static_cast<size_t>(ceil(p * sorted_samples.size()));
+    return sorted_samples[max<size_t>(rank, 1) - 1];
+}
+
+inline uint64_t AddToChecksum(uint64_t checksum, const vector<Document>& documents) {
+    for (const Document& document : documents) {
+        checksum = checksum * 31 + static_cast<uint64_t>(document.id);
+    }
+    return checksum * 31 + documents.size();
+}
+
+// Repeats run(samples) and summarizes the samples it appends. run returns the checksum of its results
+template <typename Run>
+BenchmarkResult MeasureCase(string name, string unit, int repetitions, Run run) {
+    BenchmarkResult result{ move(name), move(unit), repetitions };
+    vector<double> samples;
+    vector<double> repetition_ns;
+    for (int i = 0; i < repetitions; ++i) {
+        const auto start_time = Clock::now();
+        result.checksum = run(samples);
+        repetition_ns.push_back(ToNanoseconds(Clock::now() - start_time));
+    }
+    sort(samples.begin(), samples.end());
+    sort(repetition_ns.begin(), repetition_ns.end());
+    result.sample_count = samples.size();
+    if (!samples.empty()) {
+        result.median_ns = GetPercentile(samples, 0.5);
+        result.p99_ns = GetPercentile(samples, 0.99);
+        result.mean_ns = accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+        result.min_ns = samples.front();
+        result.max_ns = samples.back();
+    }
+    if (!repetition_ns.empty()) {
+        result.median_repetition_ms = GetPercentile(repetition_ns, 0.5) / 1e6;
+    }
+    return result;
+}
+
+inline string EscapeJson(string_view text) {
+    string result;
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            result.push_back('\\');
+        }
+        result.push_back(c);
+    }
+    return result;
+}
+
+}  // namespace benchmark_suite_detail
+
+// Runs the cases whose names contain name_filter, writing progress to log
+vector<BenchmarkResult> RunBenchmarkSuite(const BenchmarkConfig& config, string_view name_filter, ostream& log) {
+    using namespace benchmark_suite_detail;
+    if (config.document_count <= 0 || config.dictionary_size <= 0 || config.query_count <= 0 || config.repetitions <= 0) {
+        throw invalid_argument("Benchmark sizes and repetitions must be positive"s);
+    }
+    mt19937 generator(config.seed);
+    const auto dictionary = GenerateDictionary(generator, config.dictionary_size, config.max_word_length);
+    const auto texts = GenerateQueries(generator, dictionary, config.document_count, config.max_document_words);
+    const auto queries = GenerateQueries(generator, dictionary, config.query_count, config.max_query_words);
+    const vector<int> ratings = { 1, 2, 3 };
+
+    vector<DocumentInput> inputs;
+    inputs.reserve(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) {
+        inputs.push_back({ static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, ratings });
+    }
+    SearchServer search_server(dictionary[0]);
+    search_server.AddDocuments(inputs);
+
+    using Case = function<BenchmarkResult()>;
+    const vector<pair<string, Case>> cases = {
+        { "AddDocument"s, [&]() {
+            return MeasureCase("AddDocument"s, "document"s, config.repetitions, [&](vector<double>& samples) {
+                SearchServer server(dictionary[0]);
+                for (size_t i = 0; i < texts.size(); ++i) {
+                    const auto start_time = Clock::now();
+                    server.AddDocument(static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, ratings);
+                    samples.push_back(ToNanoseconds(Clock::now() - start_time));
+                }
+                return static_cast<uint64_t>(server.GetDocumentCount());
+                });
+        } },
+        { "AddDocuments"s, [&]() {
+            return MeasureCase("AddDocuments"s, "corpus"s, config.repetitions, [&](vector<double>& samples) {
+                SearchServer server(dictionary[0]);
+                const auto start_time = Clock::now();
+                server.AddDocuments(inputs);
+                samples.push_back(ToNanoseconds(Clock::now() - start_time));
+                return static_cast<uint64_t>(server.GetDocumentCount());
+                });
+        } },
+        { "FindTopDocuments"s, [&]() {
+            return MeasureCase("FindTopDocuments"s, "query"s, config.repetitions, [&](vector<double>& samples) {
+                uint64_t checksum = 0;
+                for (const string& query : queries) {
+                    const auto start_time = Clock::now();
+                    const auto documents = search_server.FindTopDocuments(query);
+                    samples.push_back(ToNanoseconds(Clock::now() - start_time));
+                    checksum = AddToChecksum(checksum, documents);
+                }
+                return checksum;
+                });
+        } },
+        { "FindTopDocuments/par"s, [&]() {
+            return MeasureCase("FindTopDocuments/par"s, "query"s, config.repetitions, [&](vector<double>& samples) {
+                uint64_t checksum = 0;
+                for (const string& query : queries) {
+                    const auto start_time = Clock::now();
+                    const auto documents = search_server.FindTopDocuments(execution::par, query);
+                    samples.push_back(ToNanoseconds(Clock::now() - start_time));
+                    checksum = AddToChecksum(checksum, documents);
+                }
+                return checksum;
+                });
+        } },
+        { "FindTopDocuments/max_score"s, [&]() {
+            return MeasureCase("FindTopDocuments/max_score"s, "query"s, config.repetitions, [&](vector<double>& samples) {
+                uint64_t checksum = 0;
+                for (const string& query : queries) {
+                    const auto start_time = Clock::now();
+                    const auto documents = search_server.FindTopDocuments(query_engine::max_score, query);
+                    samples.push_back(ToNanoseconds(Clock::now() - start_time));
+                    checksum = AddToChecksum(checksum, documents);
+                }
+                return checksum;
+                });
+        } },
+        { "FindTopDocuments/stats"s, [&]() {
+            return MeasureCase("FindTopDocuments/stats"s, "query"s, config.repetitions, [&](vector<double>& samples) {
+                uint64_t checksum = 0;
+                QueryStats stats;
+                for (const string& query : queries) {
+                    const auto start_time = Clock::now();
+                    const auto documents = search_server.FindTopDocuments(query, stats);
+                    samples.push_back(ToNanoseconds(Clock::now() - start_time));
+                    checksum = AddToChecksum(checksum, documents);
+                }
+                return checksum;
+                });
+        } },
+        { "MatchDocument"s, [&]() {
+            return MeasureCase("MatchDocument"s, "call"s, config.repetitions, [&](vector<double>& samples) {
+                uint64_t checksum = 0;
+                for (size_t i = 0; i < queries.size(); ++i) {
+                    const int document_id = search_server.GetDocumentId(static_cast<int>(i % texts.size()));
+                    const auto start_time = Clock::now();
+                    const auto [words, status] = search_server.MatchDocument(queries[i], document_id);
+                    samples.push_back(ToNanoseconds(Clock::now() - start_time));
+                    checksum = checksum * 31 + words.size();
+                }
+                return checksum;
+                });
+        } },
+        { "ProcessQueries"s, [&]() {
+            return MeasureCase("ProcessQueries"s, "batch"s, config.repetitions, [&](vector<double>& samples) {
+                const auto start_time = Clock::now();
+                const auto results = ProcessQueries(search_server, queries);
+                samples.push_back(ToNanoseconds(Clock::now() - start_time));
+                uint64_t checksum = 0;
+                for (const auto& documents : results) {
+                    checksum = AddToChecksum(checksum, documents);
+                }
+                return checksum;
+                });
+        } },
+        { "ProcessQueriesJoined"s, [&]() {
+            return MeasureCase("ProcessQueriesJoined"s, "batch"s, config.repetitions, [&](vector<double>& samples) {
+                const auto start_time = Clock::now();
+                const auto documents = ProcessQueriesJoined(search_server, queries);
+                samples.push_back(ToNanoseconds(Clock::now() - start_time));
+                return AddToChecksum(0, documents);
+                });
+        } },
+    };
+
+    vector<BenchmarkResult> results;
+    for (const auto& [name, run_case] : cases) {
+        if (name.find(name_filter) == string::npos) {
+            continue;
+        }
+        log << "Running "s << name << "..."s << endl;
+        results.push_back(run_case());
+    }
+    return results;
+}
+
+void PrintBenchmarkResults(const vector<BenchmarkResult>& results, ostream& out) {
+    out << left << setw(28) << "case"s << right << setw(10) << "samples"s << setw(14) << "median us"s
+        << setw(14) << "p99 us"s << setw(16) << "repetition ms"s << endl;
+    for (const BenchmarkResult& result : results) {
+        out << left << setw(28) << result.name << right << setw(10) << result.sample_count
+            << fixed << setprecision(2) << setw(14) << result.median_ns / 1e3 << setw(14) << result.p99_ns / 1e3
+            << setw(16) << result.median_repetition_ms << defaultfloat << endl;
+    }
+}
+
+void WriteBenchmarkJson(const BenchmarkConfig& config, const vector<BenchmarkResult>& results, ostream& out) {
+    using benchmark_suite_detail::EscapeJson;
+    out << "{\n"s
+        << "  \"config\": {"s
+        << "\"document_count\": "s << config.document_count
+        << ", \"dictionary_size\": "s << config.dictionary_size
+        << ", \"max_word_length\": "s << config.max_word_length
+        << ", \"max_document_words\": "s << config.max_document_words
+        << ", \"query_count\": "s << config.query_count
+        << ", \"max_query_words\": "s << config.max_query_words
+        << ", \"repetitions\": "s << config.repetitions
+        << ", \"seed\": "s << config.seed << "},\n"s
+        << "  \"results\": ["s;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult& result = results[i];
+        out << (i == 0 ? "\n"s : ",\n"s) << fixed << setprecision(1)
+            << "    {\"name\": \""s << EscapeJson(result.name) << "\", \"unit\": \""s << EscapeJson(result.unit) << '"'
+            << ", \"repetitions\": "s << result.repetitions
+            << ", \"samples\": "s << result.sample_count
+            << ", \"median_ns\": "s << result.median_ns
+            << ", \"p99_ns\": "s << result.p99_ns
+            << ", \"mean_ns\": "s << result.mean_ns
+            << ", \"min_ns\": "s << result.min_ns
+            << ", \"max_ns\": "s << result.max_ns
+            << setprecision(3) << ", \"median_repetition_ms\": "s << result.median_repetition_ms
+            << ", \"checksum\": "s << result.checksum << '}' << defaultfloat;
+    }
+    out << "\n  ]\n}\n"s;
+}
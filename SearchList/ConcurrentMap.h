@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+// Map split into buckets, each guarded by its own mutex, so that threads touching
+// different keys rarely wait for each other
+template <typename Key, typename Value>
+class ConcurrentMap {
+public:
+    static_assert(std::is_integral_v<Key>, "ConcurrentMap supports only integer keys");
+
+    struct Access {
+        std::lock_guard<std::mutex> guard;
+        Value& ref_to_value;
+    };
+
+    explicit ConcurrentMap(size_t bucket_count)
+        : buckets_(bucket_count) {
+    }
+
+    Access operator[](const Key& key) {
+        Bucket& bucket = GetBucket(key);
+        return { std::lock_guard(bucket.mutex), bucket.map[key] };
+    }
+
+    void Erase(const Key& key) {
+        Bucket& bucket = GetBucket(key);
+        std::lock_guard guard(bucket.mutex);
+        bucket.map.erase(key);
+    }
+
+    std::map<Key, Value> BuildOrdinaryMap() {
+        std::map<Key, Value> result;
+        for (Bucket& bucket : buckets_) {
+            std::lock_guard guard(bucket.mutex);
+            result.insert(bucket.map.begin(), bucket.map.end());
+        }
+        return result;
+    }
+
+private:
+    struct Bucket {
+        std::mutex mutex;
+        std::map<Key, Value> map;
+    };
+
+    Bucket& GetBucket(const Key& key) {
+        return buckets_[static_cast<uint64_t>(key) % buckets_.size()];
+    }
+
+    std::vector<Bucket> buckets_;
+};
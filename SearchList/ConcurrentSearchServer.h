@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "SearchServer.h"
+
+// SearchServer that is searched and modified from many threads at once. Readers take an immutable
+// snapshot of the index and keep it alive as long as they use it; a change is applied to a private
+// version which is then published in one step, so queries never wait for indexing and every query
+// sees one consistent set of documents.
+//
+// Versions are reused instead of copying the whole index on every change: the version replaced by
+// a publication goes back to the writer once its last reader releases it, and the writer brings it up
+// to date by replaying the changes it missed. Only a version still held by readers is copied.
+// Changes are therefore kept as functions and must give the same result when applied again.
+class ConcurrentSearchServer {
+public:
+    using Snapshot = shared_ptr<const SearchServer>;
+    using Change = function<void(SearchServer&)>;
+
+    explicit ConcurrentSearchServer(SearchServer search_server)
+        : reclaimer_(make_shared<Reclaimer>()) {
+        Publish(make_unique<Version>(Version{ move(search_server), 0 }));
+    }
+
+    // The latest published index. Never blocks on writers
+    Snapshot GetSnapshot() const {
+        lock_guard guard(snapshot_mutex_);
+        return snapshot_;
+    }
+
+    // Number of changes published so far
+    uint64_t GetVersion() const {
+        lock_guard guard(snapshot_mutex_);
+        return snapshot_version_;
+    }
+
+    // Any FindTopDocuments overload of SearchServer, run on the latest snapshot
+    template <typename... Args>
+    vector<Document> FindTopDocuments(Args&&... args) const {
+        return GetSnapshot()->FindTopDocuments(forward<Args>(args)...);
+    }
+
+    int GetDocumentCount() const {
+        return GetSnapshot()->GetDocumentCount();
+    }
+
+    void AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings) {
+        Update([document_id, document = string(document), status, ratings](SearchServer& search_server) {
+            search_server.AddDocument(document_id, document, status, ratings);
+            });
+    }
+
+    template <typename DocumentRange>
+    void AddDocuments(const DocumentRange& documents) {
+        Update([documents = vector<DocumentInput>(begin(documents), end(documents))](SearchServer& search_server) {
+            search_server.AddDocuments(documents);
+            });
+    }
+
+    void RemoveDocument(int document_id) {
+        Update([document_id](SearchServer& search_server) {
+            search_server.RemoveDocument(document_id);
+            });
+    }
+
+    void SetDocumentStatus(int document_id, DocumentStatus status) {
+        Update([document_id, status](SearchServer& search_server) {
+            search_server.SetDocumentStatus(document_id, status);
+            });
+    }
+
+    // Applies the change to the next version and publishes it. Several changes made by one call become
+    // visible together. If the change throws, nothing is published and the exception is passed on.
+    // Writers are serialized
+    void Update(Change change) {
+        lock_guard guard(writer_mutex_);
+        unique_ptr<Version> version = TakeUpToDateVersion();
+        change(version->search_server);
+        version->number = snapshot_version_ + 1;
+        changes_.push_back(move(change));
+        if (changes_.size() > MAX_REPLAYED_CHANGES) {
+            changes_.pop_front();
+        }
+        Publish(move(version));
+    }
+
+    // How the versions were obtained, for tuning batch sizes
+    struct UpdateStats {
+        size_t reused_versions = 0;  // brought up to date by replaying changes
+        size_t copied_versions = 0;  // copied because readers still held the old ones
+    };
+
+    UpdateStats GetUpdateStats() const {
+        lock_guard guard(writer_mutex_);
+        return update_stats_;
+    }
+
+private:
+    static constexpr size_t MAX_REPLAYED_CHANGES = 64;
+
+    struct Version {
+        SearchServer search_server;
+        uint64_t number;  // of the last change applied
+    };
+
+    // Receives versions released by their last reader. Snapshots may outlive the server, so it is shared with them.
+    // Readers only hand versions in; the surplus ones are destroyed by the writer, so that no query pays
+    // for freeing a whole index. A second spare saves a copy when the newest one is still being read at the next change
+    struct Reclaimer {
+        static constexpr size_t MAX_SPARE_COUNT = 2;
+
+        mutex lock;
+        vector<unique_ptr<Version>> spares;  // newest last
+
+        void Return(unique_ptr<Version> version) {
+            lock_guard guard(lock);
+            const auto pos = upper_bound(spares.begin(), spares.end(), version->number, [](uint64_t number, const auto& spare) {
+                return number < spare->number;
+                });
+            spares.insert(pos, move(version));
+        }
+
+        // The newest spare, nullptr if there is none. The oldest spares beyond the ones kept for the next change
+        // are moved to surplus, for the caller to destroy outside the lock
+        unique_ptr<Version> Take(vector<unique_ptr<Version>>& surplus) {
+            lock_guard guard(lock);
+            if (spares.empty()) {
+                return nullptr;
+            }
+            unique_ptr<Version> version = move(spares.back());
+            spares.pop_back();
+            if (spares.size() >= MAX_SPARE_COUNT) {
+                const auto surplus_end = spares.end() - (MAX_SPARE_COUNT - 1);
+                move(spares.begin(), surplus_end, back_inserter(surplus));
+                spares.erase(spares.begin(), surplus_end);
+            }
+            return version;
+        }
+    };
+
+    void Publish(unique_ptr<Version> version) {
+        const uint64_t number = version->number;
+        Snapshot snapshot(&version->search_server, [reclaimer = reclaimer_, version = version.get()](const SearchServer*) {
+            reclaimer->Return(unique_ptr<Version>(version));
+            });
+        version.release();
+        {
+            lock_guard guard(snapshot_mutex_);
+            snapshot_.swap(snapshot);
+            snapshot_version_ = number;
+        }
+        // The replaced version is released here unless readers still hold it
+    }
+
+    // Under writer_mutex_: a private version with all published changes. Surplus spares are destroyed here
+    unique_ptr<Version> TakeUpToDateVersion() {
+        vector<unique_ptr<Version>> surplus;
+        unique_ptr<Version> version = reclaimer_->Take(surplus);
+        // changes_.back() made the latest version, changes_.front() the version number - changes_.size() + 1
+        if (version != nullptr && version->number + changes_.size() >= snapshot_version_) {
+            for (size_t i = changes_.size() - (snapshot_version_ - version->number); i < changes_.size(); ++i) {
+                changes_[i](version->search_server);
+            }
+            version->number = snapshot_version_;
+            ++update_stats_.reused_versions;
+            return version;
+        }
+        ++update_stats_.copied_versions;
+        return make_unique<Version>(Version{ *GetSnapshot(), snapshot_version_ });
+    }
+
+    shared_ptr<Reclaimer> reclaimer_;
+    mutable mutex snapshot_mutex_;
+    Snapshot snapshot_;
+    uint64_t snapshot_version_ = 0;  // written under both mutexes
+    mutable mutex writer_mutex_;
+    deque<Change> changes_;  // the last published changes, oldest first
+    UpdateStats update_stats_;
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+// Compressed set of document ids in the style of Roaring bitmaps: ids are grouped by their upper 16 bits,
+// every group of up to 4096 ids is a sorted array of the lower halves and a denser group is a 65536-bit bitmap.
+// So a set costs at most about 2 bytes per id and at most 8 KiB per 65536 consecutive ids
+class DocumentBitmap {
+public:
+    // Fastest when ids come in increasing order
+    void Add(int document_id) {
+        const auto value = static_cast<uint32_t>(document_id);
+        const auto key = static_cast<uint16_t>(value >> 16);
+        Container* container;
+        if (!keys_.empty() && keys_.back() == key) {
+            container = &containers_.back();
+        }
+        else {
+            const auto pos = std::lower_bound(keys_.begin(), keys_.end(), key);
+            const auto index = pos - keys_.begin();
+            if (pos == keys_.end() || *pos != key) {
+                keys_.insert(pos, key);
+                containers_.emplace(containers_.begin() + index);
+            }
+            container = &containers_[index];
+        }
+        if (container->Add(static_cast<uint16_t>(value))) {
+            ++cardinality_;
+        }
+    }
+
+    void Remove(int document_id) {
+        const auto value = static_cast<uint32_t>(document_id);
+        const auto key = static_cast<uint16_t>(value >> 16);
+        const auto pos = std::lower_bound(keys_.begin(), keys_.end(), key);
+        if (pos == keys_.end() || *pos != key) {
+            return;
+        }
+        const auto index = pos - keys_.begin();
+        Container& container = containers_[index];
+        if (!container.Remove(static_cast<uint16_t>(value))) {
+            return;
+        }
+        --cardinality_;
+        if (container.size == 0) {
+            keys_.erase(pos);
+            containers_.erase(containers_.begin() + index);
+        }
+    }
+
+    bool Contains(int document_id) const {
+        const auto value = static_cast<uint32_t>(document_id);
+        const auto key = static_cast<uint16_t>(value >> 16);
+        const auto pos = std::lower_bound(keys_.begin(), keys_.end(), key);
+        return pos != keys_.end() && *pos == key && containers_[pos - keys_.begin()].Contains(static_cast<uint16_t>(value));
+    }
+
+    bool IsEmpty() const {
+        return cardinality_ == 0;
+    }
+
+    size_t GetCardinality() const {
+        return cardinality_;
+    }
+
+    // Memory held by the containers
+    size_t GetMemoryBytes() const {
+        size_t bytes = keys_.capacity() * sizeof(uint16_t) + containers_.capacity() * sizeof(Container);
+        for (const Container& container : containers_) {
+            bytes += container.values.capacity() * sizeof(uint16_t) + container.bits.capacity() * sizeof(uint64_t);
+        }
+        return bytes;
+    }
+
+private:
+    static constexpr size_t MAX_ARRAY_SIZE = 4096;  // a larger array would outgrow the bitmap
+    static constexpr size_t MIN_BITMAP_SIZE = MAX_ARRAY_SIZE / 2;  // a gap keeps removals and additions from converting back and forth
+    static constexpr size_t BITMAP_WORDS = 65536 / 64;
+
+    struct Container {
+        std::vector<uint16_t> values;  // sorted, while the container is an array
+        std::vector<uint64_t> bits;    // BITMAP_WORDS words once it is a bitmap
+        size_t size = 0;
+
+        // false if the value was already there
+        bool Add(uint16_t value) {
+            if (!bits.empty()) {
+                uint64_t& word = bits[value / 64];
+                const uint64_t mask = uint64_t{ 1 } << (value % 64);
+                if ((word & mask) != 0) {
+                    return false;
+                }
+                word |= mask;
+                ++size;
+                return true;
+            }
+            if (values.empty() || values.back() < value) {
+                values.push_back(value);
+            }
+            else {
+                const auto pos = std::lower_bound(values.begin(), values.end(), value);
+                if (*pos == value) {
+                    return false;
+                }
+                values.insert(pos, value);
+            }
+            ++size;
+            if (values.size() > MAX_ARRAY_SIZE) {
+                bits.assign(BITMAP_WORDS, 0);
+                for (const uint16_t array_value : values) {
+                    bits[array_value / 64] |= uint64_t{ 1 } << (array_value % 64);
+                }
+                values = {};
+            }
+            return true;
+        }
+
+        // false if there was no such value
+        bool Remove(uint16_t value) {
+            if (bits.empty()) {
+                const auto pos = std::lower_bound(values.begin(), values.end(), value);
+                if (pos == values.end() || *pos != value) {
+                    return false;
+                }
+                values.erase(pos);
+                --size;
+                return true;
+            }
+            uint64_t& word = bits[value / 64];
+            const uint64_t mask = uint64_t{ 1 } << (value % 64);
+            if ((word & mask) == 0) {
+                return false;
+            }
+            word &= ~mask;
+            if (--size < MIN_BITMAP_SIZE) {
+                values.reserve(size);
+                for (size_t i = 0; i < BITMAP_WORDS; ++i) {
+                    for (uint64_t word_bits = bits[i]; word_bits != 0; word_bits &= word_bits - 1) {
+                        values.push_back(static_cast<uint16_t>(i * 64 + std::countr_zero(word_bits)));
+                    }
+                }
+                bits = {};
+            }
+            return true;
+        }
+
+        bool Contains(uint16_t value) const {
+            if (!bits.empty()) {
+                return (bits[value / 64] >> (value % 64)) & 1;
+            }
+            return std::binary_search(values.begin(), values.end(), value);
+        }
+    };
+
+    std::vector<uint16_t> keys_;  // upper halves of the ids, sorted
+    std::vector<Container> containers_;
+    size_t cardinality_ = 0;
+};
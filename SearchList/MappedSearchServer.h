@@ -0,0 +1,350 @@
+#pragma once
+
+#include <span>
+
+#include "SearchServer.h"
+#include "SearchSnapshot.h"
+#include "PostingCodec.h"
+#include "DocumentBitmap.h"
+#include "MappedFile.h"
+
+enum class SnapshotVerification {
+    CHECKSUM,     // read the whole file once and compare its checksum
+    HEADER_ONLY,  // check only the header and section bounds, pages are loaded when queries touch them
+};
+
+// Read-only search server answering queries straight from a snapshot written by SearchServer::SaveSnapshot.
+// Opening it maps the file without building any in-memory index: words and documents are found by
+// binary search over the sorted sections. Results are identical to those of the saved server,
+// except that compressed postings carry term frequencies rounded to 16 bits
+class MappedSearchServer {
+public:
+    explicit MappedSearchServer(const string& path, SnapshotVerification verification = SnapshotVerification::CHECKSUM)
+        : file_(path) {
+        if (file_.GetSize() < sizeof(SnapshotHeader)) {
+            throw SnapshotError("Snapshot "s + path + " is truncated"s);
+        }
+        const auto& header = *reinterpret_cast<const SnapshotHeader*>(file_.GetData());
+        if (!equal(begin(header.magic), end(header.magic), begin(SnapshotHeader::MAGIC))) {
+            throw SnapshotError(path + " is not a search index snapshot"s);
+        }
+        if (header.version < SnapshotHeader::MIN_SUPPORTED_VERSION || header.version > SnapshotHeader::CURRENT_VERSION
+            || header.byte_order_mark != SnapshotHeader::BYTE_ORDER_MARK) {
+            throw SnapshotError("Snapshot "s + path + " has unsupported version or byte order"s);
+        }
+        if (header.file_size != file_.GetSize()) {
+            throw SnapshotError("Snapshot "s + path + " is truncated"s);
+        }
+        if (verification == SnapshotVerification::CHECKSUM) {
+            SnapshotChecksum checksum;
+            checksum.Update(file_.GetData() + sizeof(SnapshotHeader), file_.GetSize() - sizeof(SnapshotHeader));
+            if (checksum.Get() != header.checksum) {
+                throw SnapshotError("Snapshot "s + path + " is corrupted"s);
+            }
+        }
+
+        stop_words_ = GetStringTable(header.stop_words, header.stop_word_count);
+        term_words_ = GetStringTable(header.term_words, header.term_count);
+        posting_offsets_ = GetArray<uint64_t>(header.posting_offsets, header.term_count + 1);
+        posting_encoding_ = header.version == 1 ? SnapshotPostingEncoding::PLAIN : header.posting_encoding;
+        if (posting_encoding_ == SnapshotPostingEncoding::PLAIN) {
+            postings_ = GetArray<SnapshotPosting>(header.postings, header.posting_count);
+        }
+        else if (posting_encoding_ == SnapshotPostingEncoding::COMPRESSED) {
+            compressed_postings_ = GetArray<char>(header.postings, header.postings.size);
+        }
+        else {
+            throw SnapshotError("Snapshot "s + path + " has unknown posting encoding"s);
+        }
+        documents_ = GetArray<SnapshotDocument>(header.documents, header.document_count);
+        document_ids_ = GetArray<int32_t>(header.document_ids, header.document_count);
+        if (posting_offsets_.back() != max(postings_.size(), compressed_postings_.size())
+            || !is_sorted(posting_offsets_.begin(), posting_offsets_.end())) {
+            throw SnapshotError("Snapshot "s + path + " has inconsistent postings"s);
+        }
+        if (header.max_result_document_count <= 0) {
+            throw SnapshotError("Snapshot "s + path + " has invalid max result document count"s);
+        }
+        max_result_document_count_ = header.max_result_document_count;
+        posting_count_ = header.posting_count;
+    }
+
+    template <typename DocumentPredicate>
+    vector<Document> FindTopDocuments(string_view raw_query, DocumentPredicate document_predicate) const {
+        SearchServer::QueryBuffer query_buffer;
+        const auto& query = ParseQuery(raw_query, query_buffer);
+        auto matched_documents = FindAllDocuments(query, document_predicate);
+        SelectTopDocuments(matched_documents, max_result_document_count_);
+        return matched_documents;
+    }
+
+    vector<Document> FindTopDocuments(string_view raw_query, DocumentStatus status) const {
+        return FindTopDocuments(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
+            return document_status == status;
+            });
+    }
+
+    vector<Document> FindTopDocuments(string_view raw_query) const {
+        return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
+    }
+
+    // Matched words point into the mapped file and stay valid while the server exists
+    tuple<vector<string_view>, DocumentStatus> MatchDocument(string_view raw_query, int document_id) const {
+        const SnapshotDocument* document = FindDocument(document_id);
+        if (document == nullptr) {
+            throw out_of_range("Unknown document_id"s);
+        }
+        SearchServer::QueryBuffer query_buffer;
+        const auto& query = ParseQuery(raw_query, query_buffer);
+
+        vector<string_view> matched_words;
+        for (const string_view word : query.minus_words) {
+            const size_t term_index = FindTermIndex(word);
+            if (term_index < term_words_.size() && HasPosting(term_index, document_id)) {
+                return { matched_words, static_cast<DocumentStatus>(document->status) };
+            }
+        }
+        for (const string_view word : query.plus_words) {
+            const size_t term_index = FindTermIndex(word);
+            if (term_index < term_words_.size() && HasPosting(term_index, document_id)) {
+                matched_words.push_back(term_words_[term_index]);
+            }
+        }
+        return { move(matched_words), static_cast<DocumentStatus>(document->status) };
+    }
+
+    void SetMaxResultDocumentCount(int count) {
+        if (count <= 0) {
+            throw invalid_argument("Max result document count must be positive"s);
+        }
+        max_result_document_count_ = count;
+    }
+
+    int GetMaxResultDocumentCount() const {
+        return max_result_document_count_;
+    }
+
+    int GetDocumentCount() const {
+        return static_cast<int>(documents_.size());
+    }
+
+    struct PostingStorageStats {
+        SnapshotPostingEncoding encoding = SnapshotPostingEncoding::PLAIN;
+        size_t posting_count = 0;
+        size_t bytes = 0;  // of the postings section
+    };
+
+    PostingStorageStats GetPostingStorageStats() const {
+        return { posting_encoding_, posting_count_, postings_.size_bytes() + compressed_postings_.size_bytes() };
+    }
+
+    int GetDocumentId(int index) const {
+        if (index < 0 || static_cast<size_t>(index) >= document_ids_.size()) {
+            throw out_of_range("Document index is out of range"s);
+        }
+        return document_ids_[index];
+    }
+
+private:
+    // Strings of a string table section, in the order they were written
+    class StringTable {
+    public:
+        StringTable() = default;
+
+        StringTable(span<const uint64_t> offsets, const char* bytes)
+            : offsets_(offsets)
+            , bytes_(bytes) {
+        }
+
+        size_t size() const {
+            return offsets_.size() - 1;
+        }
+
+        string_view operator[](size_t index) const {
+            return { bytes_ + offsets_[index], static_cast<size_t>(offsets_[index + 1] - offsets_[index]) };
+        }
+
+        // Index of the word in a sorted table, size() if it is absent
+        size_t Find(string_view word) const {
+            size_t left = 0;
+            size_t right = size();
+            while (left < right) {
+                const size_t middle = left + (right - left) / 2;
+                if ((*this)[middle] < word) {
+                    left = middle + 1;
+                }
+                else {
+                    right = middle;
+                }
+            }
+            return left < size() && (*this)[left] == word ? left : size();
+        }
+
+    private:
+        span<const uint64_t> offsets_ = span<const uint64_t>(&EMPTY_OFFSET, 1);
+        const char* bytes_ = nullptr;
+        inline static const uint64_t EMPTY_OFFSET = 0;
+    };
+
+    template <typename Value>
+    span<const Value> GetArray(const SnapshotSection& section, uint64_t count) const {
+        if (section.size != count * sizeof(Value) || section.offset % alignof(Value) != 0
+            || section.offset > file_.GetSize() || section.size > file_.GetSize() - section.offset) {
+            throw SnapshotError("Snapshot section is out of bounds"s);
+        }
+        return { reinterpret_cast<const Value*>(file_.GetData() + section.offset), static_cast<size_t>(count) };
+    }
+
+    StringTable GetStringTable(const SnapshotSection& section, uint64_t count) const {
+        const uint64_t offsets_size = (count + 1) * sizeof(uint64_t);
+        if (section.size < offsets_size) {
+            throw SnapshotError("Snapshot section is out of bounds"s);
+        }
+        const auto offsets = GetArray<uint64_t>({ section.offset, offsets_size }, count + 1);
+        if (offsets.back() != section.size - offsets_size || !is_sorted(offsets.begin(), offsets.end())) {
+            throw SnapshotError("Snapshot string table is inconsistent"s);
+        }
+        return { offsets, file_.GetData() + section.offset + offsets_size };
+    }
+
+    // Snapshots have no positions, so phrases are rejected
+    const SearchServer::Query& ParseQuery(string_view text, SearchServer::QueryBuffer& buffer) const {
+        const auto& query = SearchServer::ParseQuery(text, buffer, [this](string_view word) {
+            return stop_words_.Find(word) < stop_words_.size();
+            });
+        if (!query.phrase_ends.empty()) {
+            throw invalid_argument("Phrase queries need the positional index"s);
+        }
+        return query;
+    }
+
+    // term_words_.size() if the word is not indexed
+    size_t FindTermIndex(string_view word) const {
+        return term_words_.Find(word);
+    }
+
+    // Plain postings only
+    span<const SnapshotPosting> GetPostings(size_t term_index) const {
+        return postings_.subspan(posting_offsets_[term_index], posting_offsets_[term_index + 1] - posting_offsets_[term_index]);
+    }
+
+    // Compressed postings only
+    span<const char> GetCompressedPostings(size_t term_index) const {
+        return compressed_postings_.subspan(posting_offsets_[term_index], posting_offsets_[term_index + 1] - posting_offsets_[term_index]);
+    }
+
+    PostingBlockReader MakePostingReader(size_t term_index) const {
+        const auto postings = GetCompressedPostings(term_index);
+        return PostingBlockReader(postings.data(), postings.data() + postings.size());
+    }
+
+    size_t GetPostingCount(size_t term_index) const {
+        if (posting_encoding_ == SnapshotPostingEncoding::PLAIN) {
+            return GetPostings(term_index).size();
+        }
+        return MakePostingReader(term_index).GetPostingCount();
+    }
+
+    // Calls callback(document_id, term_freq) in document id order
+    template <typename Callback>
+    void ForEachTermPosting(size_t term_index, Callback callback) const {
+        if (posting_encoding_ == SnapshotPostingEncoding::PLAIN) {
+            for (const SnapshotPosting& posting : GetPostings(term_index)) {
+                callback(posting.document_id, posting.term_freq);
+            }
+            return;
+        }
+        const auto postings = GetCompressedPostings(term_index);
+        ForEachPosting(postings.data(), postings.data() + postings.size(), callback);
+    }
+
+    bool HasPosting(size_t term_index, int document_id) const {
+        if (posting_encoding_ == SnapshotPostingEncoding::PLAIN) {
+            const auto postings = GetPostings(term_index);
+            const auto pos = lower_bound(postings.begin(), postings.end(), document_id,
+                [](const SnapshotPosting& lhs, int document_id) { return lhs.document_id < document_id; });
+            return pos != postings.end() && pos->document_id == document_id;
+        }
+        PostingBlockReader reader = MakePostingReader(term_index);
+        while (reader.Next()) {
+            const size_t block_size = reader.GetBlockSize();
+            if (reader.GetDocumentId(block_size - 1) < document_id) {
+                continue;
+            }
+            for (size_t i = 0; i < block_size; ++i) {
+                if (reader.GetDocumentId(i) >= document_id) {
+                    return reader.GetDocumentId(i) == document_id;
+                }
+            }
+        }
+        return false;
+    }
+
+    // nullptr for unknown ids
+    const SnapshotDocument* FindDocument(int document_id) const {
+        const auto pos = lower_bound(documents_.begin(), documents_.end(), document_id,
+            [](const SnapshotDocument& lhs, int document_id) { return lhs.id < document_id; });
+        return pos != documents_.end() && pos->id == document_id ? &*pos : nullptr;
+    }
+
+    // For ids read from postings, which a corrupted snapshot may not list among its documents
+    const SnapshotDocument& GetPostingDocument(int document_id) const {
+        const SnapshotDocument* document = FindDocument(document_id);
+        if (document == nullptr) {
+            throw SnapshotError("Snapshot postings refer to unknown document "s + to_string(document_id));
+        }
+        return *document;
+    }
+
+    // Same summation order as SearchServer, so relevances match to the last bit.
+    // Documents of the minus words are collected first and skipped before scoring
+    template <typename DocumentPredicate>
+    vector<Document> FindAllDocuments(const SearchServer::Query& query, DocumentPredicate document_predicate) const {
+        DocumentBitmap excluded_documents;
+        for (const string_view word : query.minus_words) {
+            const size_t term_index = FindTermIndex(word);
+            if (term_index == term_words_.size()) {
+                continue;
+            }
+            ForEachTermPosting(term_index, [&](int document_id, double) {
+                excluded_documents.Add(document_id);
+                });
+        }
+
+        map<int, double> document_to_relevance;
+        for (const string_view word : query.plus_words) {
+            const size_t term_index = FindTermIndex(word);
+            if (term_index == term_words_.size()) {
+                continue;
+            }
+            const double inverse_document_freq = log(GetDocumentCount() * 1.0 / GetPostingCount(term_index));
+            ForEachTermPosting(term_index, [&](int document_id, double term_freq) {
+                if (excluded_documents.Contains(document_id)) {
+                    return;
+                }
+                const SnapshotDocument& document = GetPostingDocument(document_id);
+                if (document_predicate(document.id, static_cast<DocumentStatus>(document.status), document.rating)) {
+                    document_to_relevance[document.id] += term_freq * inverse_document_freq;
+                }
+                });
+        }
+
+        vector<Document> matched_documents;
+        for (const auto [document_id, relevance] : document_to_relevance) {
+            matched_documents.push_back({ document_id, relevance, GetPostingDocument(document_id).rating });
+        }
+        return matched_documents;
+    }
+
+    MappedFile file_;
+    StringTable stop_words_;
+    StringTable term_words_;
+    span<const uint64_t> posting_offsets_;
+    SnapshotPostingEncoding posting_encoding_ = SnapshotPostingEncoding::PLAIN;
+    span<const SnapshotPosting> postings_;  // one of these two, by posting_encoding_
+    span<const char> compressed_postings_;
+    size_t posting_count_ = 0;
+    span<const SnapshotDocument> documents_;  // sorted by id
+    span<const int32_t> document_ids_;        // in the order of adding
+    int max_result_document_count_ = MAX_RESULT_DOCUMENT_COUNT;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Ids in the order they were added, with removal that does not shift the rest. A removed id leaves
+// a dead slot, and the index-th live id is found by descending a Fenwick tree that counts live slots.
+// Adding is amortized O(1), removal and lookup by index O(log n). Dead slots are dropped in one pass
+// once they outnumber the live ones, which keeps removal amortized O(log n)
+class OrderedIdList {
+public:
+    void PushBack(int id) {
+        const size_t slot = slot_ids_.size();
+        slot_ids_.push_back(id);
+        id_to_slot_.emplace(id, slot);
+        // The new node covers the slots (slot + 1 - lowbit, slot + 1], of which only the new one is outside the tree yet
+        const size_t node = slot + 1;
+        fenwick_.push_back(1 + GetLiveCount(node - 1) - GetLiveCount(node - (node & (~node + 1))));
+        ++size_;
+    }
+
+    // Unknown ids are ignored
+    void Remove(int id) {
+        const auto it = id_to_slot_.find(id);
+        if (it == id_to_slot_.end()) {
+            return;
+        }
+        const size_t slot = it->second;
+        id_to_slot_.erase(it);
+        for (size_t node = slot + 1; node <= fenwick_.size(); node += node & (~node + 1)) {
+            --fenwick_[node - 1];
+        }
+        --size_;
+        if (slot_ids_.size() > 2 * size_ + MIN_DEAD_SLOTS) {
+            Compact();
+        }
+    }
+
+    int At(size_t index) const {
+        if (index >= size_) {
+            throw std::out_of_range("Index " + std::to_string(index) + " is out of range");
+        }
+        // Largest prefix of slots with at most index live ones, the next slot holds the wanted id
+        size_t node = 0;
+        size_t left = index;
+        for (size_t step = std::bit_floor(fenwick_.size()); step > 0; step /= 2) {
+            if (node + step <= fenwick_.size() && fenwick_[node + step - 1] <= left) {
+                node += step;
+                left -= fenwick_[node - 1];
+            }
+        }
+        return slot_ids_[node];
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    // Live ids in order
+    std::vector<int> ToVector() const {
+        std::vector<int> ids;
+        ids.reserve(size_);
+        for (size_t slot = 0; slot < slot_ids_.size(); ++slot) {
+            if (IsLiveSlot(slot)) {
+                ids.push_back(slot_ids_[slot]);
+            }
+        }
+        return ids;
+    }
+
+private:
+    static constexpr size_t MIN_DEAD_SLOTS = 64;
+
+    std::vector<int> slot_ids_;  // ids of dead slots stay until compaction
+    std::vector<uint32_t> fenwick_;
+    std::unordered_map<int, size_t> id_to_slot_;  // live ids only
+    size_t size_ = 0;
+
+    // Live slots among the first count
+    size_t GetLiveCount(size_t count) const {
+        size_t live_count = 0;
+        for (size_t node = count; node > 0; node -= node & (~node + 1)) {
+            live_count += fenwick_[node - 1];
+        }
+        return live_count;
+    }
+
+    // A removed id may have been added again in a later slot
+    bool IsLiveSlot(size_t slot) const {
+        const auto it = id_to_slot_.find(slot_ids_[slot]);
+        return it != id_to_slot_.end() && it->second == slot;
+    }
+
+    void Compact() {
+        const std::vector<int> live_ids = ToVector();
+        slot_ids_.clear();
+        fenwick_.clear();
+        id_to_slot_.clear();
+        size_ = 0;
+        for (const int id : live_ids) {
+            PushBack(id);
+        }
+    }
+};
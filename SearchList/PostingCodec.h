@@ -0,0 +1,340 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "SearchSnapshot.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define POSTING_CODEC_SSE2 1
+#endif
+
+// Compressed posting list of an immutable index segment:
+//
+//  uint32 posting count, uint32 reserved, double max term frequency of the list
+//  full blocks of POSTING_BLOCK_SIZE postings:
+//      uint8 bit width, document id deltas bit-packed in 4 interleaved lanes, uint16 term frequencies
+//  tail of the remaining postings: document id deltas as varints, uint16 term frequencies
+//
+// A delta is the difference from the previous document id (from 0 for the first posting).
+// In a block lane k holds deltas k, k + 4, k + 8, ..., so that four of them are unpacked by one SSE2 instruction.
+// Term frequencies are stored in 1/65535 units of the list maximum, which keeps 4-5 significant digits.
+// Readers are given the end of the list and throw SnapshotError instead of reading past it.
+
+constexpr size_t POSTING_BLOCK_SIZE = 128;
+
+namespace posting_codec_detail {
+
+constexpr size_t LANE_COUNT = 4;
+constexpr size_t LANE_SIZE = POSTING_BLOCK_SIZE / LANE_COUNT;
+constexpr double MAX_QUANTIZED_FREQ = 65535.0;
+
+inline uint32_t GetBitWidth(uint32_t value) {
+    uint32_t width = 0;
+    for (; value != 0; value >>= 1) {
+        ++width;
+    }
+    return width;
+}
+
+inline void PackBlock(const uint32_t* values, uint32_t width, std::vector<char>& output) {
+    if (width == 0) {
+        return;
+    }
+    std::vector<uint32_t> words(LANE_COUNT * width);
+    for (size_t lane = 0; lane < LANE_COUNT; ++lane) {
+        uint32_t bit = 0;
+        for (size_t i = 0; i < LANE_SIZE; ++i, bit += width) {
+            const uint64_t value = values[i * LANE_COUNT + lane];
+            const size_t word = bit / 32;
+            const uint32_t shift = bit % 32;
+            words[word * LANE_COUNT + lane] |= static_cast<uint32_t>(value << shift);
+            if (shift + width > 32) {
+                words[(word + 1) * LANE_COUNT + lane] |= static_cast<uint32_t>(value >> (32 - shift));
+            }
+        }
+    }
+    const char* bytes = reinterpret_cast<const char*>(words.data());
+    output.insert(output.end(), bytes, bytes + words.size() * sizeof(uint32_t));
+}
+
+inline void UnpackBlockScalar(const char* input, uint32_t width, uint32_t* values) {
+    const uint32_t mask = width == 32 ? ~uint32_t{ 0 } : (uint32_t{ 1 } << width) - 1;
+    for (size_t lane = 0; lane < LANE_COUNT; ++lane) {
+        const auto load = [&](size_t word) {
+            uint32_t result;
+            std::memcpy(&result, input + (word * LANE_COUNT + lane) * sizeof(uint32_t), sizeof(result));
+            return result;
+        };
+        uint32_t current = load(0);
+        uint32_t words_read = 1;
+        uint32_t shift = 0;
+        for (size_t i = 0; i < LANE_SIZE; ++i) {
+            uint32_t value = current >> shift;
+            shift += width;
+            if (shift >= 32) {
+                shift -= 32;
+                if (words_read < width) {
+                    current = load(words_read++);
+                    if (shift > 0) {
+                        value |= current << (width - shift);
+                    }
+                }
+            }
+            values[i * LANE_COUNT + lane] = value & mask;
+        }
+    }
+}
+
+inline void PrefixSumScalar(uint32_t* values, uint32_t base) {
+    for (size_t i = 0; i < POSTING_BLOCK_SIZE; ++i) {
+        base += values[i];
+        values[i] = base;
+    }
+}
+
+#ifdef POSTING_CODEC_SSE2
+// The same walk as UnpackBlockScalar, done for all four lanes at once
+inline void UnpackBlockSse2(const char* input, uint32_t width, uint32_t* values) {
+    const auto* words = reinterpret_cast<const __m128i*>(input);
+    const __m128i mask = _mm_set1_epi32(width == 32 ? -1 : static_cast<int>((uint32_t{ 1 } << width) - 1));
+    __m128i current = _mm_loadu_si128(words);
+    uint32_t words_read = 1;
+    uint32_t shift = 0;
+    for (size_t i = 0; i < LANE_SIZE; ++i) {
+        __m128i value = _mm_srl_epi32(current, _mm_cvtsi32_si128(static_cast<int>(shift)));
+        shift += width;
+        if (shift >= 32) {
+            shift -= 32;
+            if (words_read < width) {
+                current = _mm_loadu_si128(words + words_read++);
+                if (shift > 0) {
+                    value = _mm_or_si128(value, _mm_sll_epi32(current, _mm_cvtsi32_si128(static_cast<int>(width - shift))));
+                }
+            }
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values) + i, _mm_and_si128(value, mask));
+    }
+}
+
+inline void PrefixSumSse2(uint32_t* values, uint32_t base) {
+    __m128i carry = _mm_set1_epi32(static_cast<int>(base));
+    for (size_t i = 0; i < LANE_SIZE; ++i) {
+        auto* pointer = reinterpret_cast<__m128i*>(values) + i;
+        __m128i sums = _mm_loadu_si128(pointer);
+        sums = _mm_add_epi32(sums, _mm_slli_si128(sums, 4));
+        sums = _mm_add_epi32(sums, _mm_slli_si128(sums, 8));
+        sums = _mm_add_epi32(sums, carry);
+        _mm_storeu_si128(pointer, sums);
+        carry = _mm_shuffle_epi32(sums, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+}
+#endif
+
+// Deltas of a block into document ids following base
+inline void DecodeBlock(const char* input, uint32_t width, uint32_t base, uint32_t* document_ids) {
+    if (width == 0) {
+        std::fill(document_ids, document_ids + POSTING_BLOCK_SIZE, base);
+        return;
+    }
+#ifdef POSTING_CODEC_SSE2
+    UnpackBlockSse2(input, width, document_ids);
+    PrefixSumSse2(document_ids, base);
+#else
+    UnpackBlockScalar(input, width, document_ids);
+    PrefixSumScalar(document_ids, base);
+#endif
+}
+
+inline void WriteVarint(uint32_t value, std::vector<char>& output) {
+    while (value >= 0x80) {
+        output.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    output.push_back(static_cast<char>(value));
+}
+
+constexpr uint32_t MAX_VARINT_SIZE = 5;
+
+inline void CheckAvailable(const char* input, const char* end, size_t size) {
+    if (static_cast<size_t>(end - input) < size) {
+        throw SnapshotError("Compressed postings are truncated");
+    }
+}
+
+inline uint32_t ReadVarint(const char*& input, const char* end) {
+    uint32_t value = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+        CheckAvailable(input, end, 1);
+        if (shift == MAX_VARINT_SIZE * 7) {
+            throw SnapshotError("Compressed postings have an overlong varint");
+        }
+        const auto byte = static_cast<unsigned char>(*input++);
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+}
+
+template <typename Value>
+void WriteRaw(const Value& value, std::vector<char>& output) {
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    output.insert(output.end(), bytes, bytes + sizeof(Value));
+}
+
+// The caller has checked the size
+template <typename Value>
+Value ReadRaw(const char*& input) {
+    Value value;
+    std::memcpy(&value, input, sizeof(Value));
+    input += sizeof(Value);
+    return value;
+}
+
+template <typename Value>
+Value ReadRaw(const char*& input, const char* end) {
+    CheckAvailable(input, end, sizeof(Value));
+    return ReadRaw<Value>(input);
+}
+
+}  // namespace posting_codec_detail
+
+// Appends the compressed list to output. Postings need document_id and term_freq members,
+// ids must be non-negative and increasing, frequencies positive
+template <typename Postings>
+void EncodePostings(const Postings& postings, std::vector<char>& output) {
+    using namespace posting_codec_detail;
+    const size_t posting_count = std::size(postings);
+    double max_term_freq = 0.0;
+    for (const auto& posting : postings) {
+        max_term_freq = std::max(max_term_freq, static_cast<double>(posting.term_freq));
+    }
+    WriteRaw(static_cast<uint32_t>(posting_count), output);
+    WriteRaw(uint32_t{ 0 }, output);
+    WriteRaw(max_term_freq, output);
+
+    std::vector<uint32_t> deltas;
+    std::vector<uint16_t> term_freqs;
+    deltas.reserve(posting_count);
+    term_freqs.reserve(posting_count);
+    uint32_t previous_id = 0;
+    for (const auto& posting : postings) {
+        const auto document_id = static_cast<uint32_t>(posting.document_id);
+        deltas.push_back(document_id - previous_id);
+        previous_id = document_id;
+        const double quantized = std::round(posting.term_freq / max_term_freq * MAX_QUANTIZED_FREQ);
+        term_freqs.push_back(static_cast<uint16_t>(std::clamp(quantized, 1.0, MAX_QUANTIZED_FREQ)));
+    }
+
+    const auto write_term_freqs = [&](size_t begin, size_t end) {
+        const char* bytes = reinterpret_cast<const char*>(term_freqs.data() + begin);
+        output.insert(output.end(), bytes, bytes + (end - begin) * sizeof(uint16_t));
+    };
+    size_t begin = 0;
+    for (; begin + POSTING_BLOCK_SIZE <= posting_count; begin += POSTING_BLOCK_SIZE) {
+        const uint32_t width = GetBitWidth(*std::max_element(deltas.begin() + begin, deltas.begin() + begin + POSTING_BLOCK_SIZE));
+        output.push_back(static_cast<char>(width));
+        PackBlock(deltas.data() + begin, width, output);
+        write_term_freqs(begin, begin + POSTING_BLOCK_SIZE);
+    }
+    for (size_t i = begin; i < posting_count; ++i) {
+        WriteVarint(deltas[i], output);
+    }
+    write_term_freqs(begin, posting_count);
+}
+
+// Walks a compressed list block by block. Every block is decoded into the reader's own buffers,
+// so readers need no allocation and any number of them may work at once
+class PostingBlockReader {
+public:
+    // end is the end of this list, not of the section holding it
+    PostingBlockReader(const char* data, const char* end)
+        : input_(data)
+        , end_(end) {
+        using namespace posting_codec_detail;
+        remaining_ = ReadRaw<uint32_t>(input_, end_);
+        posting_count_ = remaining_;
+        ReadRaw<uint32_t>(input_, end_);
+        term_freq_unit_ = ReadRaw<double>(input_, end_) / MAX_QUANTIZED_FREQ;
+    }
+
+    size_t GetPostingCount() const {
+        return posting_count_;
+    }
+
+    double GetMaxTermFreq() const {
+        return term_freq_unit_ * posting_codec_detail::MAX_QUANTIZED_FREQ;
+    }
+
+    // Decodes the next block, false when the list is over
+    bool Next() {
+        using namespace posting_codec_detail;
+        if (remaining_ == 0) {
+            size_ = 0;
+            return false;
+        }
+        const uint32_t base = size_ == 0 ? 0 : document_ids_[size_ - 1];
+        if (remaining_ >= POSTING_BLOCK_SIZE) {
+            const auto width = ReadRaw<uint8_t>(input_, end_);
+            if (width > 32) {
+                throw SnapshotError("Compressed postings have an invalid bit width");
+            }
+            CheckAvailable(input_, end_, LANE_COUNT * width * sizeof(uint32_t) + POSTING_BLOCK_SIZE * sizeof(uint16_t));
+            DecodeBlock(input_, width, base, document_ids_);
+            input_ += LANE_COUNT * width * sizeof(uint32_t);
+            size_ = POSTING_BLOCK_SIZE;
+        }
+        else {
+            uint32_t document_id = base;
+            for (size_t i = 0; i < remaining_; ++i) {
+                document_id += ReadVarint(input_, end_);
+                document_ids_[i] = document_id;
+            }
+            size_ = remaining_;
+            CheckAvailable(input_, end_, size_ * sizeof(uint16_t));
+        }
+        for (size_t i = 0; i < size_; ++i) {
+            term_freqs_[i] = ReadRaw<uint16_t>(input_) * term_freq_unit_;
+        }
+        remaining_ -= size_;
+        return true;
+    }
+
+    size_t GetBlockSize() const {
+        return size_;
+    }
+
+    int GetDocumentId(size_t index) const {
+        return static_cast<int>(document_ids_[index]);
+    }
+
+    double GetTermFreq(size_t index) const {
+        return term_freqs_[index];
+    }
+
+private:
+    const char* input_;
+    const char* const end_;
+    size_t posting_count_ = 0;
+    size_t remaining_ = 0;
+    double term_freq_unit_ = 0.0;
+    size_t size_ = 0;
+    uint32_t document_ids_[POSTING_BLOCK_SIZE];
+    double term_freqs_[POSTING_BLOCK_SIZE];
+};
+
+// Calls callback(document_id, term_freq) for every posting of a compressed list in document id order
+template <typename Callback>
+void ForEachPosting(const char* data, const char* end, Callback callback) {
+    PostingBlockReader reader(data, end);
+    while (reader.Next()) {
+        for (size_t i = 0; i < reader.GetBlockSize(); ++i) {
+            callback(reader.GetDocumentId(i), reader.GetTermFreq(i));
+        }
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// LRU cache of search results. Every entry remembers the index epoch it was computed at
+// and is dropped when looked up with another epoch, so modifying the index invalidates the whole cache.
+//
+// Entries are spread over independently locked shards to let many query threads use the cache at once.
+// A copy of the cache gets the same limits but no entries.
+template <typename Result>
+class QueryResultCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+
+    QueryResultCache() = default;
+
+    QueryResultCache(size_t max_entries, size_t max_bytes) {
+        Reset(max_entries, max_bytes);
+    }
+
+    QueryResultCache(const QueryResultCache& other) {
+        Reset(other.max_entries_, other.max_bytes_);
+    }
+
+    QueryResultCache& operator=(const QueryResultCache& other) {
+        if (this != &other) {
+            Reset(other.max_entries_, other.max_bytes_);
+        }
+        return *this;
+    }
+
+    // Zero max_entries disables the cache. Not thread-safe
+    void Reset(size_t max_entries, size_t max_bytes) {
+        max_entries_ = max_entries;
+        max_bytes_ = max_bytes;
+        hits_ = 0;
+        misses_ = 0;
+        evictions_ = 0;
+        shards_.clear();
+        if (max_entries == 0) {
+            return;
+        }
+        // Small caches stay in one shard, so that they evict in exact LRU order
+        const size_t shard_count = std::clamp<size_t>(max_entries / MIN_SHARD_ENTRIES, 1, MAX_SHARD_COUNT);
+        for (size_t i = 0; i < shard_count; ++i) {
+            shards_.push_back(std::make_unique<Shard>(max_entries / shard_count, max_bytes / shard_count));
+        }
+    }
+
+    bool IsEnabled() const {
+        return !shards_.empty();
+    }
+
+    std::optional<Result> Find(std::string_view key, uint64_t epoch) const {
+        Shard& shard = GetShard(key);
+        std::lock_guard guard(shard.mutex);
+        const auto it = shard.index.find(key);
+        if (it == shard.index.end() || it->second->epoch != epoch) {
+            if (it != shard.index.end()) {
+                shard.Erase(it->second);
+            }
+            ++misses_;
+            return std::nullopt;
+        }
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        ++hits_;
+        return it->second->result;
+    }
+
+    // result_bytes is the caller's estimate of the memory held by the result
+    void Insert(std::string key, uint64_t epoch, const Result& result, size_t result_bytes) {
+        Shard& shard = GetShard(key);
+        const size_t entry_bytes = key.size() + result_bytes + ENTRY_OVERHEAD;
+        if (entry_bytes > shard.max_bytes) {
+            return;
+        }
+        std::lock_guard guard(shard.mutex);
+        if (const auto it = shard.index.find(key); it != shard.index.end()) {
+            shard.Erase(it->second);
+        }
+        shard.entries.push_front({ std::move(key), epoch, result, entry_bytes });
+        shard.index.emplace(shard.entries.front().key, shard.entries.begin());
+        shard.bytes += entry_bytes;
+        while (shard.entries.size() > shard.max_entries || shard.bytes > shard.max_bytes) {
+            shard.Erase(std::prev(shard.entries.end()));
+            ++evictions_;
+        }
+    }
+
+    Stats GetStats() const {
+        Stats stats;
+        stats.hits = hits_;
+        stats.misses = misses_;
+        stats.evictions = evictions_;
+        for (const auto& shard : shards_) {
+            std::lock_guard guard(shard->mutex);
+            stats.entries += shard->entries.size();
+            stats.bytes += shard->bytes;
+        }
+        return stats;
+    }
+
+private:
+    static constexpr size_t MAX_SHARD_COUNT = 16;
+    static constexpr size_t MIN_SHARD_ENTRIES = 64;
+    static constexpr size_t ENTRY_OVERHEAD = 96;  // list and hash nodes
+
+    struct Entry {
+        std::string key;
+        uint64_t epoch;
+        Result result;
+        size_t bytes;
+    };
+
+    struct Shard {
+        Shard(size_t max_entries, size_t max_bytes)
+            : max_entries(std::max<size_t>(max_entries, 1))
+            , max_bytes(max_bytes) {
+        }
+
+        void Erase(typename std::list<Entry>::iterator it) {
+            bytes -= it->bytes;
+            index.erase(it->key);
+            entries.erase(it);
+        }
+
+        std::mutex mutex;
+        std::list<Entry> entries;  // most recently used first
+        std::unordered_map<std::string_view, typename std::list<Entry>::iterator> index;  // keys point into entries
+        size_t bytes = 0;
+        const size_t max_entries;
+        const size_t max_bytes;
+    };
+
+    Shard& GetShard(std::string_view key) const {
+        return *shards_[std::hash<std::string_view>{}(key) % shards_.size()];
+    }
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    size_t max_entries_ = 0;
+    size_t max_bytes_ = 0;
+    mutable std::atomic<uint64_t> hits_ = 0;
+    mutable std::atomic<uint64_t> misses_ = 0;
+    std::atomic<uint64_t> evictions_ = 0;
+};
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "SearchServer.h"
+
+// Fixed set of threads, each with its own deque for the tasks it spawns, plus one shared queue for tasks of other threads.
+// A thread takes its newest spawned task first, then the oldest task of the shared queue and, when out of work,
+// steals the oldest task of another thread. So clients are served in the order they submitted, while nested
+// tasks run depth-first. The number of waiting tasks is bounded: Submit blocks until there is room and
+// TrySubmit gives up, so fast clients cannot queue unbounded work. Tasks submitted from the pool's own
+// threads are never blocked, which keeps nested submission from deadlocking.
+// The destructor runs the remaining tasks, then joins the threads
+class WorkStealingThreadPool {
+public:
+    using Task = function<void()>;
+    // Optional flag of a submitted task that is set while the task takes room in the queue. The room is freed once,
+    // by the worker taking the task or earlier by ReleaseRoom
+    using RoomToken = shared_ptr<atomic<bool>>;
+
+    WorkStealingThreadPool(size_t thread_count, size_t max_queued_tasks)
+        : max_queued_tasks_(max_queued_tasks) {
+        if (thread_count == 0 || max_queued_tasks == 0) {
+            throw invalid_argument("Thread pool needs threads and room for tasks"s);
+        }
+        for (size_t i = 0; i < thread_count; ++i) {
+            workers_.push_back(make_unique<Worker>());
+        }
+        for (size_t i = 0; i < thread_count; ++i) {
+            threads_.emplace_back([this, i]() {
+                Run(i);
+                });
+        }
+    }
+
+    WorkStealingThreadPool(const WorkStealingThreadPool&) = delete;
+    WorkStealingThreadPool& operator=(const WorkStealingThreadPool&) = delete;
+
+    ~WorkStealingThreadPool() {
+        {
+            lock_guard guard(state_mutex_);
+            is_stopping_ = true;
+        }
+        has_work_.notify_all();
+        for (thread& worker_thread : threads_) {
+            worker_thread.join();
+        }
+    }
+
+    void Submit(Task task, RoomToken room = nullptr) {
+        unique_lock lock(state_mutex_);
+        if (!IsPoolThread()) {
+            has_room_.wait(lock, [this]() {
+                return room_taken_count_ < max_queued_tasks_;
+                });
+        }
+        Push({ move(task), move(room) }, lock);
+    }
+
+    // false if the queue is full
+    bool TrySubmit(Task task, RoomToken room = nullptr) {
+        unique_lock lock(state_mutex_);
+        if (!IsPoolThread() && room_taken_count_ >= max_queued_tasks_) {
+            return false;
+        }
+        Push({ move(task), move(room) }, lock);
+        return true;
+    }
+
+    // For a queued task that has nothing left to do when it runs, such as a cancelled query.
+    // Its room is given to the next submission at once instead of when a worker reaches the task
+    void ReleaseRoom(const RoomToken& room) {
+        if (!room->exchange(false)) {
+            return;
+        }
+        {
+            lock_guard guard(state_mutex_);
+            --room_taken_count_;
+        }
+        has_room_.notify_one();
+    }
+
+    size_t GetThreadCount() const {
+        return threads_.size();
+    }
+
+    // Tasks waiting in the queue, without those whose room was released
+    size_t GetQueuedTaskCount() const {
+        lock_guard guard(state_mutex_);
+        return room_taken_count_;
+    }
+
+private:
+    struct QueuedTask {
+        Task task;
+        RoomToken room;
+    };
+
+    struct Worker {
+        mutex lock;
+        deque<QueuedTask> tasks;
+    };
+
+    const size_t max_queued_tasks_;
+    vector<unique_ptr<Worker>> workers_;
+    vector<thread> threads_;
+    mutable mutex state_mutex_;
+    condition_variable has_work_;
+    condition_variable has_room_;
+    mutex client_tasks_mutex_;
+    deque<QueuedTask> client_tasks_;  // submitted by threads outside the pool, oldest first
+    size_t queued_task_count_ = 0;    // pushed and not yet taken, under state_mutex_
+    size_t room_taken_count_ = 0;     // the queued tasks whose room is not released yet, under state_mutex_
+    bool is_stopping_ = false;
+
+    // Pool and index of the worker running on this thread
+    inline static thread_local const WorkStealingThreadPool* current_pool_ = nullptr;
+    inline static thread_local size_t current_worker_ = 0;
+
+    bool IsPoolThread() const {
+        return current_pool_ == this;
+    }
+
+    void Push(QueuedTask task, unique_lock<mutex>& lock) {
+        ++queued_task_count_;
+        ++room_taken_count_;
+        if (task.room != nullptr) {
+            task.room->store(true);
+        }
+        lock.unlock();
+        if (IsPoolThread()) {
+            lock_guard guard(workers_[current_worker_]->lock);
+            workers_[current_worker_]->tasks.push_back(move(task));
+        }
+        else {
+            lock_guard guard(client_tasks_mutex_);
+            client_tasks_.push_back(move(task));
+        }
+        has_work_.notify_one();
+    }
+
+    // Own newest task, the oldest client task or the oldest task of another worker
+    bool TryTake(size_t index, QueuedTask& task) {
+        {
+            Worker& worker = *workers_[index];
+            lock_guard guard(worker.lock);
+            if (!worker.tasks.empty()) {
+                task = move(worker.tasks.back());
+                worker.tasks.pop_back();
+                return true;
+            }
+        }
+        {
+            lock_guard guard(client_tasks_mutex_);
+            if (!client_tasks_.empty()) {
+                task = move(client_tasks_.front());
+                client_tasks_.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < workers_.size(); ++i) {
+            Worker& worker = *workers_[(index + i) % workers_.size()];
+            lock_guard guard(worker.lock);
+            if (worker.tasks.empty()) {
+                continue;
+            }
+            task = move(worker.tasks.front());
+            worker.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void Run(size_t index) {
+        current_pool_ = this;
+        current_worker_ = index;
+        while (true) {
+            QueuedTask task;
+            if (TryTake(index, task)) {
+                {
+                    lock_guard guard(state_mutex_);
+                    --queued_task_count_;
+                    if (task.room == nullptr || task.room->exchange(false)) {
+                        --room_taken_count_;
+                    }
+                }
+                has_room_.notify_one();
+                task.task();
+                continue;
+            }
+            unique_lock lock(state_mutex_);
+            // A counted task may still be on its way into a deque, then the loop just retries
+            has_work_.wait(lock, [this]() {
+                return queued_task_count_ > 0 || is_stopping_;
+                });
+            if (queued_task_count_ == 0 && is_stopping_) {
+                return;
+            }
+        }
+    }
+};
+
+class QueryCancelledError : public runtime_error {
+public:
+    QueryCancelledError()
+        : runtime_error("Query was cancelled"s) {
+    }
+};
+
+// Runs FindTopDocuments queries of many client threads on one WorkStealingThreadPool, one thread per core
+// by default, so that concurrent batches keep the cores busy without oversubscribing them. Every query runs
+// sequentially on one pool thread. The server must not be modified while queries run
+class QueryExecutor {
+public:
+    // Result of a submitted query
+    class QueryHandle {
+    public:
+        // Waits for the result; rethrows the query's exception or QueryCancelledError
+        vector<Document> Get() {
+            return future_.get();
+        }
+
+        future<vector<Document>>& GetFuture() {
+            return future_;
+        }
+
+        // Succeeds only before the query has started, and then frees its place in the queue at once.
+        // Must not race with the destruction of the executor
+        bool Cancel() {
+            int expected = PENDING;
+            if (!state_->compare_exchange_strong(expected, CANCELLED)) {
+                return false;
+            }
+            pool_->ReleaseRoom(room_);
+            return true;
+        }
+
+    private:
+        friend class QueryExecutor;
+
+        enum : int { PENDING, RUNNING, CANCELLED };
+
+        QueryHandle(future<vector<Document>> result, shared_ptr<atomic<int>> state, WorkStealingThreadPool* pool,
+            WorkStealingThreadPool::RoomToken room)
+            : future_(move(result))
+            , state_(move(state))
+            , pool_(pool)
+            , room_(move(room)) {
+        }
+
+        future<vector<Document>> future_;
+        shared_ptr<atomic<int>> state_;
+        WorkStealingThreadPool* pool_;
+        WorkStealingThreadPool::RoomToken room_;
+    };
+
+    static constexpr size_t DEFAULT_MAX_QUEUED_QUERIES = 1024;
+
+    explicit QueryExecutor(const SearchServer& search_server, size_t thread_count = max(thread::hardware_concurrency(), 1u),
+        size_t max_queued_queries = DEFAULT_MAX_QUEUED_QUERIES)
+        : search_server_(search_server)
+        , pool_(thread_count, max_queued_queries) {
+    }
+
+    // Blocks while the queue is full
+    QueryHandle Submit(string raw_query, DocumentStatus status = DocumentStatus::ACTUAL) {
+        auto [task, handle] = MakeQuery(move(raw_query), status);
+        pool_.Submit(move(task), handle.room_);
+        return move(handle);
+    }
+
+    // document_predicate is copied and may be called from any pool thread
+    template <typename DocumentPredicate>
+    QueryHandle Submit(string raw_query, DocumentPredicate document_predicate) {
+        auto [task, handle] = MakeQuery(move(raw_query), move(document_predicate));
+        pool_.Submit(move(task), handle.room_);
+        return move(handle);
+    }
+
+    // nullopt if the queue is full
+    optional<QueryHandle> TrySubmit(string raw_query, DocumentStatus status = DocumentStatus::ACTUAL) {
+        auto [task, handle] = MakeQuery(move(raw_query), status);
+        if (!pool_.TrySubmit(move(task), handle.room_)) {
+            return nullopt;
+        }
+        return move(handle);
+    }
+
+    // Results in the order of the queries. Queries beyond the queue bound are submitted as room frees up
+    vector<vector<Document>> ProcessQueries(const vector<string>& queries) {
+        vector<QueryHandle> handles;
+        handles.reserve(queries.size());
+        for (const string& query : queries) {
+            handles.push_back(Submit(query));
+        }
+        vector<vector<Document>> results;
+        results.reserve(queries.size());
+        for (QueryHandle& handle : handles) {
+            results.push_back(handle.Get());
+        }
+        return results;
+    }
+
+    size_t GetThreadCount() const {
+        return pool_.GetThreadCount();
+    }
+
+    size_t GetQueuedQueryCount() const {
+        return pool_.GetQueuedTaskCount();
+    }
+
+private:
+    const SearchServer& search_server_;
+    WorkStealingThreadPool pool_;
+
+    // Query arguments after the raw query are passed on to FindTopDocuments
+    template <typename Argument>
+    pair<WorkStealingThreadPool::Task, QueryHandle> MakeQuery(string raw_query, Argument argument) {
+        auto state = make_shared<atomic<int>>(QueryHandle::PENDING);
+        // function needs a copyable task, so the promise is shared
+        auto result = make_shared<promise<vector<Document>>>();
+        QueryHandle handle(result->get_future(), state, &pool_, make_shared<atomic<bool>>(false));
+        auto task = [this, raw_query = move(raw_query), argument = move(argument), state, result]() {
+            int expected = QueryHandle::PENDING;
+            if (!state->compare_exchange_strong(expected, QueryHandle::RUNNING)) {
+                result->set_exception(make_exception_ptr(QueryCancelledError()));
+                return;
+            }
+            try {
+                result->set_value(search_server_.FindTopDocuments(raw_query, argument));
+            }
+            catch (...) {
+                result->set_exception(current_exception());
+            }
+        };
+        return { move(task), move(handle) };
+    }
+};
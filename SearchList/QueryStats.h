@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+// What one query did, filled by the FindTopDocuments and MatchDocument overloads that take it.
+// Counting adds a few increments to the loops that run anyway and timing four clock reads,
+// so it is cheap enough for sampled production queries
+struct QueryStats {
+    std::size_t plus_word_count = 0;        // after stop words and repeats are dropped
+    std::size_t minus_word_count = 0;
+    std::size_t postings_walked = 0;        // postings of the plus words read, or posting lists searched by MatchDocument
+    std::size_t predicate_calls = 0;        // calls of the status filter or the document predicate
+    std::size_t minus_word_exclusions = 0;  // postings skipped because their document has a minus word or lacks a phrase
+    std::size_t accumulator_size = 0;       // documents given a relevance, before the top is selected
+
+    std::chrono::nanoseconds parse_time{};
+    std::chrono::nanoseconds minus_words_time{};    // finding the documents of the minus words and of the phrases
+    std::chrono::nanoseconds score_time{};          // walking the postings, including the per-document minus word checks
+    std::chrono::nanoseconds top_documents_time{};  // selecting and sorting the top
+
+    std::chrono::nanoseconds GetTotalTime() const {
+        return parse_time + minus_words_time + score_time + top_documents_time;
+    }
+};
+
+// Adds the time until the end of the block to one of the durations of stats. Does nothing without stats
+class QueryPhaseTimer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    QueryPhaseTimer(QueryStats* stats, std::chrono::nanoseconds QueryStats::* phase_time)
+        : stats_(stats)
+        , phase_time_(phase_time) {
+        if (stats_ != nullptr) {
+            start_time_ = Clock::now();
+        }
+    }
+
+    QueryPhaseTimer(const QueryPhaseTimer&) = delete;
+    QueryPhaseTimer& operator=(const QueryPhaseTimer&) = delete;
+
+    ~QueryPhaseTimer() {
+        if (stats_ != nullptr) {
+            stats_->*phase_time_ += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_time_);
+        }
+    }
+
+private:
+    QueryStats* const stats_;
+    std::chrono::nanoseconds QueryStats::* const phase_time_;
+    Clock::time_point start_time_;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "SearchServer.h"
+
+struct DuplicatesReport {
+    vector<int> removed_document_ids;
+    size_t removed_postings = 0;
+    size_t reclaimed_bytes = 0;  // estimate: posting arrays plus forward index nodes
+};
+
+// Order-dependent hash of the document's term ids. GetWordFrequencies keeps words sorted,
+// so equal word sets always produce the same sequence
+uint64_t ComputeWordSetFingerprint(const SearchServer& search_server, const map<string_view, double>& word_frequencies) {
+    uint64_t fingerprint = 14695981039346656037ull;  // FNV-1a over 32-bit term ids
+    for (const auto& [word, _] : word_frequencies) {
+        fingerprint ^= static_cast<uint32_t>(search_server.GetTermId(word));
+        fingerprint *= 1099511628211ull;
+    }
+    return fingerprint;
+}
+
+bool HaveSameWords(const map<string_view, double>& lhs, const map<string_view, double>& rhs) {
+    return lhs.size() == rhs.size()
+        && equal(lhs.begin(), lhs.end(), rhs.begin(), [](const auto& lhs_word, const auto& rhs_word) {
+        return lhs_word.first == rhs_word.first;
+            });
+}
+
+// Documents with the same set of non-stop words are duplicates, the one with the lowest id is kept
+DuplicatesReport RemoveDuplicates(SearchServer& search_server) {
+    vector<int> document_ids;
+    document_ids.reserve(search_server.GetDocumentCount());
+    for (int index = 0; index < search_server.GetDocumentCount(); ++index) {
+        document_ids.push_back(search_server.GetDocumentId(index));
+    }
+    sort(document_ids.begin(), document_ids.end());
+
+    DuplicatesReport report;
+    // Hash collisions are resolved by comparing the word sets of the kept documents
+    unordered_map<uint64_t, vector<int>> fingerprint_to_kept_ids;
+    for (const int document_id : document_ids) {
+        const auto& word_frequencies = search_server.GetWordFrequencies(document_id);
+        auto& kept_ids = fingerprint_to_kept_ids[ComputeWordSetFingerprint(search_server, word_frequencies)];
+        const bool is_duplicate = any_of(kept_ids.begin(), kept_ids.end(), [&](int kept_id) {
+            return HaveSameWords(search_server.GetWordFrequencies(kept_id), word_frequencies);
+            });
+        if (is_duplicate) {
+            report.removed_document_ids.push_back(document_id);
+            report.removed_postings += word_frequencies.size();
+        }
+        else {
+            kept_ids.push_back(document_id);
+        }
+    }
+
+    const size_t forward_index_node_size = sizeof(map<string_view, double>::value_type) + 4 * sizeof(void*);
+    report.reclaimed_bytes = report.removed_postings * (sizeof(pair<int, double>) + forward_index_node_size);
+    search_server.RemoveDocuments(report.removed_document_ids);
+    return report;
+}
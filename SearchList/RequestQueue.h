@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "SearchServer.h"
+
+// Statistics over the last window_size find requests (by default one request per minute of a day).
+// Requests are recorded into a fixed ring of slots: a new request overwrites the oldest one and
+// the counters are corrected by both records, so recording is O(1) and takes no locks.
+// Many threads may add requests at once; while they do, the counters may briefly disagree with each other
+// and with the slots.
+class RequestQueue {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t MIN_IN_DAY = 1440;
+
+    struct WindowStats {
+        size_t requests = 0;
+        size_t no_result_requests = 0;
+        uint64_t total_results = 0;
+        std::chrono::nanoseconds total_latency{ 0 };
+        std::chrono::nanoseconds max_latency{ 0 };
+
+        double GetMeanResults() const {
+            return requests == 0 ? 0.0 : static_cast<double>(total_results) / requests;
+        }
+
+        std::chrono::nanoseconds GetMeanLatency() const {
+            return requests == 0 ? std::chrono::nanoseconds(0) : total_latency / static_cast<int64_t>(requests);
+        }
+    };
+
+    explicit RequestQueue(const SearchServer& search_server, size_t window_size = MIN_IN_DAY)
+        : search_server_(search_server)
+        , window_size_(window_size)
+        , slots_(std::make_unique<std::atomic<uint64_t>[]>(window_size)) {
+        if (window_size == 0) {
+            throw invalid_argument("Request window must not be empty"s);
+        }
+    }
+
+    template <typename DocumentPredicate>
+    vector<Document> AddFindRequest(string_view raw_query, DocumentPredicate document_predicate) {
+        const auto start_time = Clock::now();
+        auto documents = search_server_.FindTopDocuments(raw_query, document_predicate);
+        RecordRequest(documents.size(), Clock::now() - start_time);
+        return documents;
+    }
+
+    vector<Document> AddFindRequest(string_view raw_query, DocumentStatus status) {
+        const auto start_time = Clock::now();
+        auto documents = search_server_.FindTopDocuments(raw_query, status);
+        RecordRequest(documents.size(), Clock::now() - start_time);
+        return documents;
+    }
+
+    vector<Document> AddFindRequest(string_view raw_query) {
+        return AddFindRequest(raw_query, DocumentStatus::ACTUAL);
+    }
+
+    int GetNoResultRequests() const {
+        return static_cast<int>(LoadCounter(no_result_requests_));
+    }
+
+    // Maximum latency is found by scanning the window, everything else is read from the counters
+    WindowStats GetWindowStats() const {
+        WindowStats stats;
+        stats.requests = requests_.load(memory_order_relaxed);
+        stats.no_result_requests = static_cast<size_t>(LoadCounter(no_result_requests_));
+        stats.total_results = LoadCounter(total_results_);
+        stats.total_latency = std::chrono::nanoseconds(LoadCounter(total_latency_ns_));
+        for (size_t i = 0; i < window_size_; ++i) {
+            const Record record = Unpack(slots_[i].load(memory_order_relaxed));
+            stats.max_latency = std::max(stats.max_latency, std::chrono::nanoseconds(record.latency_ns));
+        }
+        return stats;
+    }
+
+private:
+    // A slot packs a whole record into one word so that it is replaced by a single atomic exchange:
+    // bit 63 marks a used slot, bits 40-62 hold the result count, bits 0-39 the latency in nanoseconds.
+    // Both values saturate, which only happens for results above 8M or latencies above 18 minutes
+    static constexpr uint64_t USED_BIT = uint64_t{ 1 } << 63;
+    static constexpr int RESULT_COUNT_SHIFT = 40;
+    static constexpr uint64_t MAX_RESULT_COUNT = (uint64_t{ 1 } << 23) - 1;
+    static constexpr uint64_t MAX_LATENCY_NS = (uint64_t{ 1 } << RESULT_COUNT_SHIFT) - 1;
+
+    struct Record {
+        bool is_used = false;
+        uint64_t result_count = 0;
+        uint64_t latency_ns = 0;
+    };
+
+    static uint64_t Pack(uint64_t result_count, uint64_t latency_ns) {
+        return USED_BIT
+            | (std::min(result_count, MAX_RESULT_COUNT) << RESULT_COUNT_SHIFT)
+            | std::min(latency_ns, MAX_LATENCY_NS);
+    }
+
+    // A record may be subtracted by the thread that overwrites its slot before the thread that wrote it
+    // has added it, so a counter can be briefly negative. Readers see such a moment as zero
+    static uint64_t LoadCounter(const std::atomic<int64_t>& counter) {
+        return static_cast<uint64_t>(std::max<int64_t>(counter.load(memory_order_relaxed), 0));
+    }
+
+    static Record Unpack(uint64_t slot) {
+        return { (slot & USED_BIT) != 0, (slot >> RESULT_COUNT_SHIFT) & MAX_RESULT_COUNT, slot & MAX_LATENCY_NS };
+    }
+
+    void RecordRequest(size_t result_count, Clock::duration latency) {
+        const auto latency_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+        const uint64_t slot = Pack(result_count, latency_ns);
+        const uint64_t index = next_slot_.fetch_add(1, memory_order_relaxed) % window_size_;
+        const Record expired = Unpack(slots_[index].exchange(slot, memory_order_relaxed));
+
+        const Record added = Unpack(slot);
+        if (added.result_count == 0) {
+            no_result_requests_.fetch_add(1, memory_order_relaxed);
+        }
+        total_results_.fetch_add(static_cast<int64_t>(added.result_count), memory_order_relaxed);
+        total_latency_ns_.fetch_add(static_cast<int64_t>(added.latency_ns), memory_order_relaxed);
+        if (!expired.is_used) {
+            requests_.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        if (expired.result_count == 0) {
+            no_result_requests_.fetch_sub(1, memory_order_relaxed);
+        }
+        total_results_.fetch_sub(static_cast<int64_t>(expired.result_count), memory_order_relaxed);
+        total_latency_ns_.fetch_sub(static_cast<int64_t>(expired.latency_ns), memory_order_relaxed);
+    }
+
+    const SearchServer& search_server_;
+    const size_t window_size_;
+    std::unique_ptr<std::atomic<uint64_t>[]> slots_;
+    std::atomic<uint64_t> next_slot_ = 0;
+    std::atomic<size_t> requests_ = 0;
+    std::atomic<int64_t> no_result_requests_ = 0;  // signed, see LoadCounter
+    std::atomic<int64_t> total_results_ = 0;
+    std::atomic<int64_t> total_latency_ns_ = 0;
+};
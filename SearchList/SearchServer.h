@@ -11,18 +11,41 @@
 #include <execution>
 #include <ratio>
 #include <cmath>
-#include <Windows.h>
-#include <random>
+#include <map>
+#include <set>
+#include <vector>
 #include <cstdlib>
 #include <tuple>
 #include <cstdbool>
 #include <cassert>
 #include <cctype>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <string_view>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <limits>
+#include <array>
+#include <bit>
+#include <iterator>
+#include <optional>
 
 #include "Framework.h"
 #include "logtime.h"
+#include "ConcurrentMap.h"
+#include "StringArena.h"
+#include "QueryCache.h"
+#include "QueryStats.h"
+#include "SearchSnapshot.h"
+#include "PostingCodec.h"
+#include "TextScan.h"
+#include "DocumentBitmap.h"
+#include "OrderedIdList.h"
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
+const double RELEVANCE_EPSILON = 1e-6;
 using namespace std;
 
 string ReadLine() {
@@ -38,20 +61,27 @@ int ReadLineWithNumber() {
     return result;
 }
 
-std::vector<std::string> SplitIntoWords(std::string_view str) {
-    std::vector<std::string> result;
-    const int64_t pos_end = str.npos;
-    while (true) {
-        int64_t space = str.find(' ');
-        result.push_back(space == pos_end ? static_cast<string>(str.substr(0)) : static_cast<string> (str.substr(0, space)));
-        if (space == pos_end) {
-            break;
-        }
-        else {
-            str.remove_prefix(space + 1);
+// Words are views into str. The buffer is cleared first, so reusing it keeps its capacity.
+// Every space ends a word, so repeated, leading and trailing spaces give empty words
+void SplitIntoWords(std::string_view str, std::vector<std::string_view>& result) {
+    result.clear();
+    thread_local std::vector<uint64_t> space_bits;
+    space_bits.resize((str.size() + 63) / 64);
+    GetTextScanKernels().mark_spaces(str.data(), str.size(), space_bits.data());
+    size_t word_begin = 0;
+    for (size_t i = 0; i < space_bits.size(); ++i) {
+        for (uint64_t bits = space_bits[i]; bits != 0; bits &= bits - 1) {
+            const size_t space = i * 64 + std::countr_zero(bits);
+            result.push_back(str.substr(word_begin, space - word_begin));
+            word_begin = space + 1;
         }
     }
+    result.push_back(str.substr(word_begin));
+}
 
+std::vector<std::string_view> SplitIntoWords(std::string_view str) {
+    std::vector<std::string_view> result;
+    SplitIntoWords(str, result);
     return result;
 }
 
@@ -77,12 +107,55 @@ ostream& operator<<(ostream& out, const Document& document) {
     return out;
 }
 
+// Ranking order of search results: relevance, then rating for relevances closer than RELEVANCE_EPSILON,
+// then document id so that equally ranked documents always come out in the same order
+bool IsMoreRelevant(const Document& lhs, const Document& rhs) {
+    if (abs(lhs.relevance - rhs.relevance) < RELEVANCE_EPSILON) {
+        if (lhs.rating == rhs.rating) {
+            return lhs.id < rhs.id;
+        }
+        return lhs.rating > rhs.rating;
+    }
+    else {
+        return lhs.relevance > rhs.relevance;
+    }
+}
+
+// Leaves the count most relevant documents in ranking order. Only they get sorted, the rest
+// is discarded after a linear nth_element pass
+void SelectTopDocuments(vector<Document>& documents, size_t count) {
+    PROFILE_SCOPE("SelectTopDocuments");
+    if (documents.size() > count) {
+        nth_element(documents.begin(), documents.begin() + count, documents.end(), IsMoreRelevant);
+        documents.resize(count);
+    }
+    sort(documents.begin(), documents.end(), IsMoreRelevant);
+}
+
+// Where a page of search results ended: the relevance, rating and id of its last document.
+// FindTopDocumentsPage continues after it
+class SearchCursor {
+private:
+    friend class SearchServer;
+
+    explicit SearchCursor(const Document& last_document)
+        : last_document_(last_document) {
+    }
+
+    Document last_document_;
+};
+
+struct SearchPage {
+    vector<Document> documents;       // in ranking order
+    optional<SearchCursor> next_page;  // nullopt on the last page
+};
+
 template <typename StringContainer>
-set<string> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
-    set<string> non_empty_strings;
-    for (const string& str : strings) {
+set<string, less<>> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
+    set<string, less<>> non_empty_strings;
+    for (const auto& str : strings) {
         if (!str.empty()) {
-            non_empty_strings.insert(str);
+            non_empty_strings.emplace(str);
         }
     }
     return non_empty_strings;
@@ -95,7 +168,48 @@ enum class DocumentStatus {
     REMOVED,
 };
 
+// One element of SearchServer::AddDocuments input
+struct DocumentInput {
+    int id = 0;
+    string text;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    vector<int> ratings;
+};
+
+// Thrown by SearchServer::AddDocuments, names the document that could not be added
+class DocumentLoadError : public invalid_argument {
+public:
+    DocumentLoadError(int document_id, size_t index, const string& reason)
+        : invalid_argument("Document "s + to_string(document_id) + " (#"s + to_string(index) + "): "s + reason)
+        , document_id_(document_id)
+        , index_(index) {
+    }
+
+    int GetDocumentId() const {
+        return document_id_;
+    }
+
+    // Position of the document in the input range
+    size_t GetIndex() const {
+        return index_;
+    }
+
+private:
+    int document_id_;
+    size_t index_;
+};
+
+// Query engines of FindTopDocuments, passed like execution policies. The default one scores every matching
+// document term by term; max_score walks the posting lists together and skips documents that cannot enter the top
+namespace query_engine {
+struct MaxScore {};
+inline constexpr MaxScore max_score;
+}  // namespace query_engine
+
 class SearchServer {
+    friend class MappedSearchServer;
+    friend class ShardedSearchServer;
+
 public:
     template <typename StringContainer>
     explicit SearchServer(const StringContainer& stop_words)
@@ -106,120 +220,927 @@ public:
         }
     }
 
-    explicit SearchServer(const string& stop_words_text)
+    explicit SearchServer(string_view stop_words_text)
         : SearchServer(SplitIntoWords(stop_words_text))  // Invoke delegating constructor
         // from string container
     {
     }
 
-    void AddDocument(int document_id, const string& document, DocumentStatus status, const vector<int>& ratings) {
+    explicit SearchServer(const string& stop_words_text)
+        : SearchServer(string_view(stop_words_text)) {
+    }
+
+    void AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings) {
+        PROFILE_SCOPE("AddDocument");
         if ((document_id < 0) || (documents_.count(document_id) > 0)) {
             throw invalid_argument("Invalid document_id"s);
         }
+        if (!IsValidStatus(status)) {
+            throw invalid_argument("Invalid document status"s);
+        }
         const auto words = SplitIntoWordsNoStop(document);
 
+        vector<int> term_ids;
+        term_ids.reserve(words.size());
+        for (const string_view word : words) {
+            term_ids.push_back(GetOrAddTermId(word));
+        }
+        if (has_positional_index_) {
+            AddPositions(document_id, term_ids);
+        }
+        sort(term_ids.begin(), term_ids.end());
+
+        DocumentData document_data{ ComputeAverageRating(ratings), status, {} };
         const double inv_word_count = 1.0 / words.size();
-        for (const string& word : words) {
-            word_to_document_freqs_[word][document_id] += inv_word_count;
+        for (auto it = term_ids.begin(); it != term_ids.end();) {
+            const int term_id = *it;
+            double term_freq = 0.0;
+            for (; it != term_ids.end() && *it == term_id; ++it) {
+                term_freq += inv_word_count;
+            }
+            AddPosting(terms_[term_id].postings, { document_id, term_freq });
+            document_data.word_frequencies.emplace(term_words_[term_id], term_freq);
         }
-        documents_.emplace(document_id, DocumentData{ ComputeAverageRating(ratings), status });
-        document_ids_.push_back(document_id);
+        documents_.emplace(document_id, move(document_data));
+        document_ids_.PushBack(document_id);
+        status_documents_[static_cast<size_t>(status)].Add(document_id);
+        ++document_set_epoch_;
     }
 
-    template <typename DocumentPredicate>
-    vector<Document> FindTopDocuments(const string& raw_query, DocumentPredicate document_predicate) const {
-        const auto query = ParseQuery(raw_query);
-
-        auto matched_documents = FindAllDocuments(query, document_predicate);
+    // Bulk loading in three stages: documents are split into words and validated on all threads,
+    // every thread builds postings of its own slice of documents, then the slices are merged into the index.
+    // Either the whole batch is added or, if some document has an invalid or repeated id or an invalid word,
+    // nothing is and DocumentLoadError names the first such document of the range.
+    // Elements of the range need id, text, status and ratings members like DocumentInput
+    template <typename ExecutionPolicy, typename DocumentRange>
+    void AddDocuments(const ExecutionPolicy& policy, const DocumentRange& documents) {
+        PROFILE_SCOPE("AddDocuments");
+        using Element = typename iterator_traits<decltype(std::begin(documents))>::value_type;
+        vector<const Element*> inputs;
+        for (const auto& document : documents) {
+            inputs.push_back(&document);
+        }
 
-        sort(matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
-            if (abs(lhs.relevance - rhs.relevance) < 1e-6) {
-                return lhs.rating > rhs.rating;
+        vector<string> errors(inputs.size());
+        unordered_set<int> batch_ids;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            const int document_id = inputs[i]->id;
+            if (document_id < 0 || documents_.count(document_id) > 0 || !batch_ids.insert(document_id).second) {
+                errors[i] = "Invalid document_id"s;
             }
-            else {
-                return lhs.relevance > rhs.relevance;
+            else if (!IsValidStatus(inputs[i]->status)) {
+                errors[i] = "Invalid document status"s;
+            }
+        }
+
+        const size_t slice_count = min<size_t>(max(thread::hardware_concurrency(), 1u), max<size_t>(inputs.size(), 1));
+        vector<IndexSlice> slices(slice_count);
+        for (size_t i = 0; i < slice_count; ++i) {
+            slices[i].begin = inputs.size() * i / slice_count;
+            slices[i].end = inputs.size() * (i + 1) / slice_count;
+        }
+        for_each(policy, slices.begin(), slices.end(), [&](IndexSlice& slice) {
+            for (size_t i = slice.begin; i < slice.end; ++i) {
+                if (errors[i].empty()) {
+                    try {
+                        auto words = SplitIntoWordsNoStop(inputs[i]->text);
+                        if (has_positional_index_) {
+                            slice.document_words.push_back(words);
+                        }
+                        slice.Add(inputs[i]->id, move(words));
+                    }
+                    catch (const invalid_argument& e) {
+                        errors[i] = e.what();
+                    }
+                }
             }
             });
-        if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-            matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (!errors[i].empty()) {
+                throw DocumentLoadError(inputs[i]->id, i, errors[i]);
+            }
         }
 
-        return matched_documents;
+        vector<bool> is_term_touched(terms_.size());
+        vector<vector<int>> slice_term_ids(slices.size());
+        for (size_t slice_index = 0; slice_index < slices.size(); ++slice_index) {
+            const IndexSlice& slice = slices[slice_index];
+            for (size_t local_id = 0; local_id < slice.words.size(); ++local_id) {
+                const int term_id = GetOrAddTermId(slice.words[local_id]);
+                slice_term_ids[slice_index].push_back(term_id);
+                is_term_touched.resize(terms_.size());
+                is_term_touched[term_id] = true;
+                auto& term_postings = terms_[term_id].postings;
+                term_postings.insert(term_postings.end(), slice.postings[local_id].begin(), slice.postings[local_id].end());
+            }
+        }
+        for (size_t term_id = 0; term_id < is_term_touched.size(); ++term_id) {
+            auto& postings = terms_[term_id].postings;
+            if (is_term_touched[term_id] && !is_sorted(postings.begin(), postings.end(), IsPostingBefore)) {
+                sort(postings.begin(), postings.end(), IsPostingBefore);
+            }
+        }
+
+        for (size_t slice_index = 0; slice_index < slices.size(); ++slice_index) {
+            const IndexSlice& slice = slices[slice_index];
+            for (size_t i = slice.begin; i < slice.end; ++i) {
+                const auto& input = *inputs[i];
+                DocumentData document_data{ ComputeAverageRating(input.ratings), input.status, {} };
+                for (const auto& [local_id, term_freq] : slice.word_frequencies[i - slice.begin]) {
+                    const string_view word = term_words_[slice_term_ids[slice_index][local_id]];
+                    document_data.word_frequencies.emplace_hint(document_data.word_frequencies.end(), word, term_freq);
+                }
+                documents_.emplace(input.id, move(document_data));
+                document_ids_.PushBack(input.id);
+                status_documents_[static_cast<size_t>(input.status)].Add(input.id);
+                if (has_positional_index_) {
+                    vector<int> term_ids;
+                    for (const string_view word : slice.document_words[i - slice.begin]) {
+                        term_ids.push_back(word_to_term_id_.at(word));
+                    }
+                    ForEachTermOffsets(term_ids, [&](int term_id, const vector<uint32_t>& offsets) {
+                        term_positions_[term_id].Append(input.id, offsets.data(), offsets.data() + offsets.size());
+                        });
+                }
+            }
+        }
+        if (has_positional_index_) {
+            // Appended in input order, so each touched term is sorted once instead of inserting in the middle
+            for (size_t term_id = 0; term_id < is_term_touched.size(); ++term_id) {
+                if (is_term_touched[term_id]) {
+                    term_positions_[term_id].SortByDocument();
+                }
+            }
+        }
+        ++document_set_epoch_;
+    }
+
+    template <typename DocumentRange>
+    void AddDocuments(const DocumentRange& documents) {
+        AddDocuments(execution::par, documents);
+    }
+
+    // Touches only the posting lists of the document's own words, but erasing from a list shifts its tail,
+    // so the cost is O(total length of those lists), a memmove each. Unknown ids are ignored
+    void RemoveDocument(int document_id) {
+        const auto document_it = documents_.find(document_id);
+        if (document_it == documents_.end()) {
+            return;
+        }
+        for (const auto& [word, _] : document_it->second.word_frequencies) {
+            RemovePosting(terms_[word_to_term_id_.at(word)].postings, document_id);
+        }
+        RemovePositions(document_id, document_it->second.word_frequencies);
+        EraseDocumentData(document_it);
+        ++document_set_epoch_;
+    }
+
+    // Filters every posting list touched by the documents once, so removing D documents costs
+    // O(total length of the touched lists) instead of that per document. Unknown and repeated ids are ignored
+    void RemoveDocuments(const vector<int>& document_ids) {
+        DocumentBitmap removed_documents;
+        vector<int> touched_term_ids;
+        for (const int document_id : document_ids) {
+            const auto document_it = documents_.find(document_id);
+            if (document_it == documents_.end() || removed_documents.Contains(document_id)) {
+                continue;
+            }
+            removed_documents.Add(document_id);
+            for (const auto& [word, _] : document_it->second.word_frequencies) {
+                touched_term_ids.push_back(word_to_term_id_.at(word));
+            }
+        }
+        if (removed_documents.IsEmpty()) {
+            return;
+        }
+        sort(touched_term_ids.begin(), touched_term_ids.end());
+        touched_term_ids.erase(unique(touched_term_ids.begin(), touched_term_ids.end()), touched_term_ids.end());
+        for (const int term_id : touched_term_ids) {
+            PostingList& postings = terms_[term_id].postings;
+            postings.erase(remove_if(postings.begin(), postings.end(), [&removed_documents](const Posting& posting) {
+                return removed_documents.Contains(posting.document_id);
+                }), postings.end());
+            if (has_positional_index_) {
+                term_positions_[term_id].RemoveAll(removed_documents);
+            }
+        }
+        for (const int document_id : document_ids) {
+            const auto document_it = documents_.find(document_id);
+            if (document_it != documents_.end()) {
+                EraseDocumentData(document_it);
+            }
+        }
+        ++document_set_epoch_;
+    }
+
+    void RemoveDocument(const execution::sequenced_policy&, int document_id) {
+        RemoveDocument(document_id);
     }
 
-    vector<Document> FindTopDocuments(const string& raw_query, DocumentStatus status) const {
-        return FindTopDocuments(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-            return document_status == status;
+    // Every word owns a separate posting list, so the lists are trimmed concurrently
+    void RemoveDocument(const execution::parallel_policy& policy, int document_id) {
+        const auto document_it = documents_.find(document_id);
+        if (document_it == documents_.end()) {
+            return;
+        }
+        const auto& word_frequencies = document_it->second.word_frequencies;
+        vector<PostingList*> postings(word_frequencies.size());
+        transform(word_frequencies.begin(), word_frequencies.end(), postings.begin(), [this](const auto& word_freq) {
+            return &terms_[word_to_term_id_.at(word_freq.first)].postings;
+            });
+        for_each(policy, postings.begin(), postings.end(), [document_id](PostingList* term_postings) {
+            RemovePosting(*term_postings, document_id);
             });
+        RemovePositions(document_id, word_frequencies);
+        EraseDocumentData(document_it);
+        ++document_set_epoch_;
     }
 
-    vector<Document> FindTopDocuments(const string& raw_query) const {
+    // The index is not touched, only the status bitmaps. Cached results are invalidated, the per-term caches
+    // do not depend on statuses and are kept
+    void SetDocumentStatus(int document_id, DocumentStatus status) {
+        if (!IsValidStatus(status)) {
+            throw invalid_argument("Invalid document status"s);
+        }
+        DocumentData& document_data = documents_.at(document_id);
+        if (document_data.status == status) {
+            return;
+        }
+        status_documents_[static_cast<size_t>(document_data.status)].Remove(document_id);
+        status_documents_[static_cast<size_t>(status)].Add(document_id);
+        document_data.status = status;
+        ++document_status_epoch_;
+    }
+
+    // Empty map for unknown ids
+    const map<string_view, double>& GetWordFrequencies(int document_id) const {
+        static const map<string_view, double> empty_word_frequencies;
+        const auto document_it = documents_.find(document_id);
+        if (document_it == documents_.end()) {
+            return empty_word_frequencies;
+        }
+        return document_it->second.word_frequencies;
+    }
+
+    template <typename DocumentPredicate>
+    vector<Document> FindTopDocuments(string_view raw_query, DocumentPredicate document_predicate) const {
+        PROFILE_SCOPE("FindTopDocuments");
+        QueryBuffer query_buffer;
+        const Query& query = ParseQuery(raw_query, query_buffer);
+
+        return FindTopDocumentsForQuery(execution::seq, query, MakePredicateFilter(document_predicate));
+    }
+
+    vector<Document> FindTopDocuments(string_view raw_query, DocumentStatus status) const {
+        return FindTopDocumentsByStatus(execution::seq, raw_query, status);
+    }
+
+    vector<Document> FindTopDocuments(string_view raw_query) const {
         return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
     }
 
+    template <typename DocumentPredicate>
+    vector<Document> FindTopDocuments(const execution::sequenced_policy&, string_view raw_query, DocumentPredicate document_predicate) const {
+        return FindTopDocuments(raw_query, document_predicate);
+    }
+
+    vector<Document> FindTopDocuments(const execution::sequenced_policy&, string_view raw_query, DocumentStatus status) const {
+        return FindTopDocuments(raw_query, status);
+    }
+
+    vector<Document> FindTopDocuments(const execution::sequenced_policy&, string_view raw_query) const {
+        return FindTopDocuments(raw_query);
+    }
+
+    // document_predicate is called from several threads at once
+    template <typename DocumentPredicate>
+    vector<Document> FindTopDocuments(const execution::parallel_policy& policy, string_view raw_query, DocumentPredicate document_predicate) const {
+        PROFILE_SCOPE("FindTopDocuments");
+        QueryBuffer query_buffer;
+        const Query& query = ParseQuery(raw_query, query_buffer);
+
+        return FindTopDocumentsForQuery(policy, query, MakePredicateFilter(document_predicate));
+    }
+
+    vector<Document> FindTopDocuments(const execution::parallel_policy& policy, string_view raw_query, DocumentStatus status) const {
+        return FindTopDocumentsByStatus(policy, raw_query, status);
+    }
+
+    vector<Document> FindTopDocuments(const execution::parallel_policy& policy, string_view raw_query) const {
+        return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+    }
+
+    // Same results as the overloads above. Pays off for queries of several words over many documents
+    // and when few results are requested
+    template <typename DocumentPredicate>
+    vector<Document> FindTopDocuments(const query_engine::MaxScore& engine, string_view raw_query, DocumentPredicate document_predicate) const {
+        PROFILE_SCOPE("FindTopDocuments");
+        QueryBuffer query_buffer;
+        const Query& query = ParseQuery(raw_query, query_buffer);
+
+        return FindTopDocumentsForQuery(engine, query, MakePredicateFilter(document_predicate));
+    }
+
+    vector<Document> FindTopDocuments(const query_engine::MaxScore& engine, string_view raw_query, DocumentStatus status) const {
+        return FindTopDocumentsByStatus(engine, raw_query, status);
+    }
+
+    vector<Document> FindTopDocuments(const query_engine::MaxScore& engine, string_view raw_query) const {
+        return FindTopDocuments(engine, raw_query, DocumentStatus::ACTUAL);
+    }
+
+    // Same results as the sequential overloads, and stats tells what the query did. The query is always
+    // run, never answered from the result cache
+    template <typename DocumentPredicate>
+    vector<Document> FindTopDocuments(string_view raw_query, DocumentPredicate document_predicate, QueryStats& stats) const {
+        return FindTopDocumentsWithStats(raw_query, document_predicate, stats);
+    }
+
+    vector<Document> FindTopDocuments(string_view raw_query, DocumentStatus status, QueryStats& stats) const {
+        return FindTopDocumentsWithStats(raw_query, status, stats);
+    }
+
+    vector<Document> FindTopDocuments(string_view raw_query, QueryStats& stats) const {
+        return FindTopDocuments(raw_query, DocumentStatus::ACTUAL, stats);
+    }
+
+    // Pages of any depth, not limited by GetMaxResultDocumentCount. A page holds the page_size documents ranked
+    // after the cursor; only they are selected and sorted, so a deep page costs the scoring of the query
+    // plus a linear pass. A cursor stays usable when documents change, the next page then follows the new ranking
+    template <typename DocumentPredicate>
+    SearchPage FindTopDocumentsPage(string_view raw_query, DocumentPredicate document_predicate, size_t page_size,
+        const optional<SearchCursor>& cursor = nullopt) const {
+        return FindTopDocumentsPageBySelector(raw_query, document_predicate, page_size, cursor);
+    }
+
+    SearchPage FindTopDocumentsPage(string_view raw_query, DocumentStatus status, size_t page_size,
+        const optional<SearchCursor>& cursor = nullopt) const {
+        return FindTopDocumentsPageBySelector(raw_query, status, page_size, cursor);
+    }
+
+    SearchPage FindTopDocumentsPage(string_view raw_query, size_t page_size, const optional<SearchCursor>& cursor = nullopt) const {
+        return FindTopDocumentsPage(raw_query, DocumentStatus::ACTUAL, page_size, cursor);
+    }
+
+    using ResultCacheStats = QueryResultCache<vector<Document>>::Stats;
+
+    // Keeps results of FindTopDocuments by status in an LRU cache limited by both entry count and bytes.
+    // Adding or removing any document invalidates all entries
+    void EnableResultCache(size_t max_entries, size_t max_bytes) {
+        result_cache_.Reset(max_entries, max_bytes);
+    }
+
+    void DisableResultCache() {
+        result_cache_.Reset(0, 0);
+    }
+
+    ResultCacheStats GetResultCacheStats() const {
+        return result_cache_.GetStats();
+    }
+
+    // Makes the server record where every word of a document occurs, which phrase queries such as
+    // "curly hair" need. Only a server without documents can get it, and a server without it spends
+    // no memory on positions. Snapshots do not keep positions
+    void EnablePositionalIndex() {
+        if (!documents_.empty()) {
+            throw invalid_argument("Positional index must be enabled before documents are added"s);
+        }
+        has_positional_index_ = true;
+        term_positions_.resize(terms_.size());
+    }
+
+    bool HasPositionalIndex() const {
+        return has_positional_index_;
+    }
+
+    // How many documents FindTopDocuments returns at most, MAX_RESULT_DOCUMENT_COUNT by default
+    void SetMaxResultDocumentCount(int count) {
+        if (count <= 0) {
+            throw invalid_argument("Max result document count must be positive"s);
+        }
+        max_result_document_count_ = count;
+    }
+
+    int GetMaxResultDocumentCount() const {
+        return max_result_document_count_;
+    }
+
     int GetDocumentCount() const {
         return documents_.size();
     }
 
     int GetDocumentId(int index) const {
-        return document_ids_.at(index);
+        return document_ids_.At(index);
+    }
+
+    // Dense id of an indexed word, stable until CompactTermStorage
+    int GetTermId(string_view word) const {
+        return word_to_term_id_.at(word);
     }
 
-    tuple<vector<string>, DocumentStatus> MatchDocument(const string& raw_query, int document_id) const {
-        const auto query = ParseQuery(raw_query);
+    struct TermStorageStats {
+        size_t term_count = 0;
+        size_t live_term_count = 0;  // terms that still have postings
+        size_t arena_bytes = 0;      // allocated for term bytes
+        size_t used_bytes = 0;       // bytes of all stored terms
+        size_t live_bytes = 0;       // bytes of live terms
+    };
+
+    TermStorageStats GetTermStorageStats() const {
+        TermStorageStats stats;
+        stats.term_count = term_words_.size();
+        stats.arena_bytes = term_storage_.GetAllocatedBytes();
+        stats.used_bytes = term_storage_.GetUsedBytes();
+        for (size_t term_id = 0; term_id < term_words_.size(); ++term_id) {
+            if (!terms_[term_id].postings.empty()) {
+                ++stats.live_term_count;
+                stats.live_bytes += term_words_[term_id].size();
+            }
+        }
+        return stats;
+    }
 
-        vector<string> matched_words;
-        for (const string& word : query.plus_words) {
-            if (word_to_document_freqs_.count(word) == 0) {
+    // Drops the words left without documents by RemoveDocument and repacks the rest into a fresh arena.
+    // Term ids get renumbered, views returned by MatchDocument and GetWordFrequencies become invalid
+    void CompactTermStorage() {
+        StringArena term_storage;
+        unordered_map<string_view, int> word_to_term_id;
+        vector<string_view> term_words;
+        vector<Term> terms;
+        vector<TermPositions> term_positions;
+        for (size_t term_id = 0; term_id < term_words_.size(); ++term_id) {
+            if (terms_[term_id].postings.empty()) {
                 continue;
             }
-            if (word_to_document_freqs_.at(word).count(document_id)) {
-                matched_words.push_back(word);
+            const string_view word = term_storage.Store(term_words_[term_id]);
+            word_to_term_id.emplace(word, static_cast<int>(term_words.size()));
+            term_words.push_back(word);
+            terms.push_back(move(terms_[term_id]));
+            if (has_positional_index_) {
+                term_positions.push_back(move(term_positions_[term_id]));
+            }
+        }
+
+        for (auto& [_, document_data] : documents_) {
+            map<string_view, double> word_frequencies;
+            for (const auto [word, term_freq] : document_data.word_frequencies) {
+                word_frequencies.emplace_hint(word_frequencies.end(), term_words[word_to_term_id.at(word)], term_freq);
+            }
+            document_data.word_frequencies = move(word_frequencies);
+        }
+
+        term_storage_ = move(term_storage);
+        word_to_term_id_ = move(word_to_term_id);
+        term_words_ = move(term_words);
+        terms_ = move(terms);
+        term_positions_ = move(term_positions);
+    }
+
+    // Writes the index into a binary file that MappedSearchServer searches without loading it.
+    // Words left without documents are not saved. Compressed postings take several times less space,
+    // but round term frequencies to 16 bits, so relevances of the loaded server differ in the 5th digit.
+    // Positions are not saved, so the loaded server does not answer phrase queries
+    void SaveSnapshot(const string& path, SnapshotPostingEncoding posting_encoding = SnapshotPostingEncoding::PLAIN) const {
+        vector<int> term_ids;
+        for (size_t term_id = 0; term_id < terms_.size(); ++term_id) {
+            if (!terms_[term_id].postings.empty()) {
+                term_ids.push_back(static_cast<int>(term_id));
             }
         }
-        for (const string& word : query.minus_words) {
-            if (word_to_document_freqs_.count(word) == 0) {
+        sort(term_ids.begin(), term_ids.end(), [this](int lhs, int rhs) {
+            return term_words_[lhs] < term_words_[rhs];
+            });
+
+        vector<string_view> words;
+        vector<uint64_t> posting_offsets;
+        vector<SnapshotPosting> postings;
+        vector<char> compressed_postings;
+        size_t posting_count = 0;
+        words.reserve(term_ids.size());
+        posting_offsets.reserve(term_ids.size() + 1);
+        posting_offsets.push_back(0);
+        for (const int term_id : term_ids) {
+            words.push_back(term_words_[term_id]);
+            const PostingList& term_postings = terms_[term_id].postings;
+            posting_count += term_postings.size();
+            if (posting_encoding == SnapshotPostingEncoding::COMPRESSED) {
+                EncodePostings(term_postings, compressed_postings);
+                posting_offsets.push_back(compressed_postings.size());
                 continue;
             }
-            if (word_to_document_freqs_.at(word).count(document_id)) {
-                matched_words.clear();
-                break;
+            for (const auto [document_id, term_freq] : term_postings) {
+                postings.push_back({ document_id, 0, term_freq });
             }
+            posting_offsets.push_back(postings.size());
+        }
+        vector<SnapshotDocument> documents;
+        documents.reserve(documents_.size());
+        for (const auto& [document_id, document_data] : documents_) {
+            documents.push_back({ document_id, document_data.rating, static_cast<int32_t>(document_data.status), 0 });
         }
-        return { matched_words, documents_.at(document_id).status };
+        const vector<int> live_document_ids = document_ids_.ToVector();
+        const vector<int32_t> document_ids(live_document_ids.begin(), live_document_ids.end());
+
+        SnapshotWriter writer(path);
+        SnapshotHeader header{};
+        header.stop_word_count = stop_words_.size();
+        header.term_count = words.size();
+        header.posting_count = posting_count;
+        header.document_count = documents.size();
+        header.max_result_document_count = max_result_document_count_;
+        header.posting_encoding = posting_encoding;
+        header.stop_words = writer.WriteStringTable(stop_words_);
+        header.term_words = writer.WriteStringTable(words);
+        header.posting_offsets = writer.WriteArray(posting_offsets);
+        header.postings = posting_encoding == SnapshotPostingEncoding::COMPRESSED
+            ? writer.WriteArray(compressed_postings)
+            : writer.WriteArray(postings);
+        header.documents = writer.WriteArray(documents);
+        header.document_ids = writer.WriteArray(document_ids);
+        writer.Close(header);
+    }
+
+    // Matched words point into the server's dictionary and stay valid until the next modification
+    tuple<vector<string_view>, DocumentStatus> MatchDocument(string_view raw_query, int document_id) const {
+        return MatchDocumentForQuery(raw_query, document_id, nullptr);
+    }
+
+    // Also fills stats; the top selection takes no time and no predicate is called
+    tuple<vector<string_view>, DocumentStatus> MatchDocument(string_view raw_query, int document_id, QueryStats& stats) const {
+        stats = {};
+        return MatchDocumentForQuery(raw_query, document_id, &stats);
     }
 
 private:
     struct DocumentData {
         int rating;
         DocumentStatus status;
+        map<string_view, double> word_frequencies;  // forward index, keys point into term_storage_
     };
-    const set<string> stop_words_;
-    map<string, map<int, double>> word_to_document_freqs_;
+    static const size_t CONCURRENT_BUCKET_COUNT = 128;
+    static constexpr size_t STATUS_COUNT = static_cast<size_t>(DocumentStatus::REMOVED) + 1;
+
+    struct Posting {
+        int document_id;
+        double term_freq;
+    };
+    using PostingList = vector<Posting>;
+
+    // Value computed by the first reader of an epoch and shared by all later ones. Concurrent readers
+    // may compute it simultaneously, they store the same result
+    class EpochCachedValue {
+    public:
+        EpochCachedValue() = default;
+
+        EpochCachedValue(const EpochCachedValue& other)
+            : epoch_(other.epoch_.load(memory_order_acquire))
+            , value_(other.value_.load(memory_order_relaxed)) {
+        }
+
+        EpochCachedValue& operator=(const EpochCachedValue& other) {
+            value_.store(other.value_.load(memory_order_relaxed), memory_order_relaxed);
+            epoch_.store(other.epoch_.load(memory_order_acquire), memory_order_release);
+            return *this;
+        }
+
+        template <typename Compute>
+        double Get(uint64_t epoch, Compute compute) const {
+            if (epoch_.load(memory_order_acquire) == epoch) {
+                return value_.load(memory_order_relaxed);
+            }
+            const double value = compute();
+            value_.store(value, memory_order_relaxed);
+            epoch_.store(epoch, memory_order_release);
+            return value;
+        }
+
+    private:
+        mutable atomic<uint64_t> epoch_ = numeric_limits<uint64_t>::max();
+        mutable atomic<double> value_ = 0.0;
+    };
+
+    // Bitmap built by the first reader of an epoch that needs it. Readers keep the bitmap they got alive,
+    // so a concurrent reader of a newer epoch may replace it meanwhile. The pointer is guarded by
+    // one of a few shared locks instead of a mutex per term
+    class EpochCachedBitmap {
+    public:
+        EpochCachedBitmap() = default;
+
+        EpochCachedBitmap(const EpochCachedBitmap& other)
+            : entry_(other.Load()) {
+        }
+
+        EpochCachedBitmap& operator=(const EpochCachedBitmap& other) {
+            if (this != &other) {
+                Store(other.Load());
+            }
+            return *this;
+        }
+
+        template <typename Build>
+        shared_ptr<const DocumentBitmap> Get(uint64_t epoch, Build build) const {
+            auto entry = Load();
+            if (entry == nullptr || entry->epoch != epoch) {
+                entry = make_shared<const Entry>(Entry{ epoch, build() });
+                Store(entry);
+            }
+            return { entry, &entry->bitmap };
+        }
+
+    private:
+        struct Entry {
+            uint64_t epoch;
+            DocumentBitmap bitmap;
+        };
+
+        static constexpr size_t LOCK_COUNT = 64;
+
+        mutex& GetLock() const {
+            static mutex locks[LOCK_COUNT];
+            return locks[reinterpret_cast<uintptr_t>(this) / sizeof(*this) % LOCK_COUNT];
+        }
+
+        shared_ptr<const Entry> Load() const {
+            lock_guard guard(GetLock());
+            return entry_;
+        }
+
+        void Store(shared_ptr<const Entry> entry) const {
+            lock_guard guard(GetLock());
+            entry_.swap(entry);
+        }
+
+        mutable shared_ptr<const Entry> entry_;
+    };
+
+    struct Term {
+        PostingList postings;
+        EpochCachedValue inverse_document_freq;
+        EpochCachedValue max_term_freq;
+        EpochCachedBitmap documents;  // built only for terms used as minus words
+    };
+
+    // Offsets of a term in the documents that have it, counted among their words without stop words.
+    // Offsets in the document document_ids[i] are positions[position_begins[i]] up to positions[position_begins[i + 1]]
+    struct TermPositions {
+        vector<int> document_ids;  // sorted
+        vector<uint32_t> position_begins{ 0 };
+        vector<uint32_t> positions;
+
+        // offsets ascending. Documents added in id order are appended, others shift the arrays
+        void Add(int document_id, const vector<uint32_t>& offsets) {
+            if (document_ids.empty() || document_ids.back() < document_id) {
+                Append(document_id, offsets.data(), offsets.data() + offsets.size());
+                return;
+            }
+            const auto it = lower_bound(document_ids.begin(), document_ids.end(), document_id);
+            const size_t index = it - document_ids.begin();
+            const uint32_t begin = position_begins[index];
+            document_ids.insert(it, document_id);
+            positions.insert(positions.begin() + begin, offsets.begin(), offsets.end());
+            position_begins.insert(position_begins.begin() + index + 1, begin + static_cast<uint32_t>(offsets.size()));
+            for (size_t i = index + 2; i < position_begins.size(); ++i) {
+                position_begins[i] += static_cast<uint32_t>(offsets.size());
+            }
+        }
+
+        // Breaks the order of document_ids unless the id is the largest, bulk loading calls SortByDocument afterwards
+        void Append(int document_id, const uint32_t* offsets_begin, const uint32_t* offsets_end) {
+            document_ids.push_back(document_id);
+            positions.insert(positions.end(), offsets_begin, offsets_end);
+            position_begins.push_back(static_cast<uint32_t>(positions.size()));
+        }
+
+        void SortByDocument() {
+            if (is_sorted(document_ids.begin(), document_ids.end())) {
+                return;
+            }
+            vector<size_t> order(document_ids.size());
+            iota(order.begin(), order.end(), 0);
+            sort(order.begin(), order.end(), [this](size_t lhs, size_t rhs) {
+                return document_ids[lhs] < document_ids[rhs];
+                });
+            TermPositions sorted;
+            sorted.document_ids.reserve(document_ids.size());
+            sorted.position_begins.reserve(position_begins.size());
+            sorted.positions.reserve(positions.size());
+            for (const size_t index : order) {
+                sorted.Append(document_ids[index], positions.data() + position_begins[index], positions.data() + position_begins[index + 1]);
+            }
+            *this = move(sorted);
+        }
+
+        void Remove(int document_id) {
+            const auto it = lower_bound(document_ids.begin(), document_ids.end(), document_id);
+            if (it == document_ids.end() || *it != document_id) {
+                return;
+            }
+            const size_t index = it - document_ids.begin();
+            const uint32_t count = position_begins[index + 1] - position_begins[index];
+            positions.erase(positions.begin() + position_begins[index], positions.begin() + position_begins[index + 1]);
+            document_ids.erase(it);
+            position_begins.erase(position_begins.begin() + index + 1);
+            for (size_t i = index + 1; i < position_begins.size(); ++i) {
+                position_begins[i] -= count;
+            }
+        }
+
+        // One pass that keeps the documents not in removed_documents
+        void RemoveAll(const DocumentBitmap& removed_documents) {
+            size_t kept_count = 0;
+            uint32_t kept_positions = 0;
+            for (size_t index = 0; index < document_ids.size(); ++index) {
+                if (removed_documents.Contains(document_ids[index])) {
+                    continue;
+                }
+                const uint32_t begin = position_begins[index];
+                const uint32_t end = position_begins[index + 1];
+                copy(positions.begin() + begin, positions.begin() + end, positions.begin() + kept_positions);
+                kept_positions += end - begin;
+                document_ids[kept_count] = document_ids[index];
+                position_begins[++kept_count] = kept_positions;
+            }
+            document_ids.resize(kept_count);
+            position_begins.resize(kept_count + 1);
+            positions.resize(kept_positions);
+        }
+    };
+
+    const set<string, less<>> stop_words_;
+    // Words are interned into dense term ids, postings of a term are sorted by document_id
+    unordered_map<string_view, int> word_to_term_id_;
+    StringArena term_storage_;  // bytes of all words, every string_view of the index points here
+    vector<string_view> term_words_;
+    vector<Term> terms_;
+    bool has_positional_index_ = false;
+    vector<TermPositions> term_positions_;  // by term id, empty without the positional index
+    uint64_t document_set_epoch_ = 0;  // changes whenever a document is added or removed
+    uint64_t document_status_epoch_ = 0;  // changes whenever a document changes status
     map<int, DocumentData> documents_;
-    vector<int> document_ids_;
+    array<DocumentBitmap, STATUS_COUNT> status_documents_;  // ids of the documents of every status
+    OrderedIdList document_ids_;  // in the order of adding
+    int max_result_document_count_ = MAX_RESULT_DOCUMENT_COUNT;
+    mutable QueryResultCache<vector<Document>> result_cache_;  // disabled unless EnableResultCache is called
+
+    int GetOrAddTermId(string_view word) {
+        if (const auto it = word_to_term_id_.find(word); it != word_to_term_id_.end()) {
+            return it->second;
+        }
+        const int term_id = static_cast<int>(term_words_.size());
+        term_words_.push_back(term_storage_.Store(word));
+        terms_.emplace_back();
+        if (has_positional_index_) {
+            term_positions_.emplace_back();
+        }
+        word_to_term_id_.emplace(term_words_.back(), term_id);
+        return term_id;
+    }
+
+    // term_ids of the document's words in text order
+    void AddPositions(int document_id, const vector<int>& term_ids) {
+        ForEachTermOffsets(term_ids, [&](int term_id, const vector<uint32_t>& offsets) {
+            term_positions_[term_id].Add(document_id, offsets);
+            });
+    }
+
+    // Calls callback(term_id, offsets) for every term of a document given by the term ids of its words
+    template <typename Callback>
+    static void ForEachTermOffsets(const vector<int>& term_ids, Callback callback) {
+        vector<pair<int, uint32_t>> term_offsets;
+        term_offsets.reserve(term_ids.size());
+        for (size_t offset = 0; offset < term_ids.size(); ++offset) {
+            term_offsets.emplace_back(term_ids[offset], static_cast<uint32_t>(offset));
+        }
+        sort(term_offsets.begin(), term_offsets.end());
+        vector<uint32_t> offsets;
+        for (auto it = term_offsets.begin(); it != term_offsets.end();) {
+            const int term_id = it->first;
+            offsets.clear();
+            for (; it != term_offsets.end() && it->first == term_id; ++it) {
+                offsets.push_back(it->second);
+            }
+            callback(term_id, offsets);
+        }
+    }
+
+    void RemovePositions(int document_id, const map<string_view, double>& word_frequencies) {
+        if (!has_positional_index_) {
+            return;
+        }
+        for (const auto& [word, _] : word_frequencies) {
+            term_positions_[word_to_term_id_.at(word)].Remove(document_id);
+        }
+    }
+
+    // nullptr if the word has never been indexed
+    const Term* FindTerm(string_view word) const {
+        const auto it = word_to_term_id_.find(word);
+        return it == word_to_term_id_.end() ? nullptr : &terms_[it->second];
+    }
 
-    bool IsStopWord(const string& word) const {
+    static bool IsPostingBefore(const Posting& lhs, const Posting& rhs) {
+        return lhs.document_id < rhs.document_id;
+    }
+
+    // Index of a slice of AddDocuments input, built by one thread. Words get ids local to the slice
+    // and point into the input texts
+    struct IndexSlice {
+        size_t begin = 0;
+        size_t end = 0;
+        unordered_map<string_view, int> word_to_local_id;
+        vector<string_view> words;
+        vector<PostingList> postings;
+        vector<vector<pair<int, double>>> word_frequencies;  // per document, by local id in word order
+        vector<vector<string_view>> document_words;          // per document in text order, only for the positional index
+
+        // Same term frequencies as AddDocument: repeats of a word are summed one by one
+        void Add(int document_id, vector<string_view> document_words) {
+            sort(document_words.begin(), document_words.end());
+            auto& frequencies = word_frequencies.emplace_back();
+            const double inv_word_count = 1.0 / document_words.size();
+            for (auto it = document_words.begin(); it != document_words.end();) {
+                const string_view word = *it;
+                double term_freq = 0.0;
+                for (; it != document_words.end() && *it == word; ++it) {
+                    term_freq += inv_word_count;
+                }
+                const auto [id_it, is_new] = word_to_local_id.emplace(word, static_cast<int>(words.size()));
+                if (is_new) {
+                    words.push_back(word);
+                    postings.emplace_back();
+                }
+                postings[id_it->second].push_back({ document_id, term_freq });
+                frequencies.emplace_back(id_it->second, term_freq);
+            }
+        }
+    };
+
+    // First posting with document id not less than the given one
+    template <typename Postings>
+    static auto FindPostingPosition(Postings& postings, int document_id) {
+        return lower_bound(postings.begin(), postings.end(), document_id,
+            [](const Posting& lhs, int document_id) { return lhs.document_id < document_id; });
+    }
+
+    static void AddPosting(PostingList& postings, Posting posting) {
+        if (postings.empty() || postings.back().document_id < posting.document_id) {
+            postings.push_back(posting);
+            return;
+        }
+        const auto pos = FindPostingPosition(postings, posting.document_id);
+        postings.insert(pos, posting);
+    }
+
+    // O(postings.size()) for the shift of the tail
+    static void RemovePosting(PostingList& postings, int document_id) {
+        const auto pos = FindPostingPosition(postings, document_id);
+        if (pos != postings.end() && pos->document_id == document_id) {
+            postings.erase(pos);
+        }
+    }
+
+    // The caller bumps document_set_epoch_, once per batch
+    void EraseDocumentData(map<int, DocumentData>::iterator document_it) {
+        status_documents_[static_cast<size_t>(document_it->second.status)].Remove(document_it->first);
+        document_ids_.Remove(document_it->first);
+        documents_.erase(document_it);
+    }
+
+    static bool HasPosting(const PostingList& postings, int document_id) {
+        const auto pos = FindPostingPosition(postings, document_id);
+        return pos != postings.end() && pos->document_id == document_id;
+    }
+
+    static bool IsValidStatus(DocumentStatus status) {
+        return static_cast<size_t>(status) < STATUS_COUNT;
+    }
+
+    bool IsStopWord(string_view word) const {
         return stop_words_.count(word) > 0;
     }
 
-    static bool IsValidWord(const string& word) {
+    static bool IsValidWord(string_view word) {
         // A valid word must not contain special characters
         return none_of(word.begin(), word.end(), [](char c) {
             return c >= '\0' && c < ' ';
             });
     }
 
-    vector<string> SplitIntoWordsNoStop(const string& text) const {
-        vector<string> words;
-        for (const string& word : SplitIntoWords(text)) {
-            if (!IsValidWord(word)) {
-                throw invalid_argument("Word "s + word + " is invalid"s);
-            }
-            if (!IsStopWord(word)) {
-                words.push_back(word);
+    vector<string_view> SplitIntoWordsNoStop(string_view text) const {
+        vector<string_view> words;
+        SplitIntoWords(text, words);
+        // Words are checked one by one only to name the first invalid one
+        if (HasControlCharacters(text)) {
+            for (const string_view word : words) {
+                if (!IsValidWord(word)) {
+                    throw invalid_argument("Word "s + string(word) + " is invalid"s);
+                }
             }
         }
+        words.erase(remove_if(words.begin(), words.end(), [this](string_view word) {
+            return IsStopWord(word);
+            }), words.end());
         return words;
     }
 
@@ -235,81 +1156,801 @@ private:
     }
 
     struct QueryWord {
-        string data;
+        string_view data;
         bool is_minus;
         bool is_stop;
     };
 
-    QueryWord ParseQueryWord(const string& text) const {
+    // Validity of characters is checked only if the whole query may contain invalid ones
+    template <typename StopWordPredicate>
+    static QueryWord ParseQueryWord(string_view text, StopWordPredicate is_stop_word, bool may_be_invalid) {
         if (text.empty()) {
             throw invalid_argument("Query word is empty"s);
         }
-        string word = text;
+        string_view word = text;
         bool is_minus = false;
         if (word[0] == '-') {
             is_minus = true;
-            word = word.substr(1);
+            word.remove_prefix(1);
         }
-        if (word.empty() || word[0] == '-' || !IsValidWord(word)) {
-            throw invalid_argument("Query word "s + text + " is invalid");
+        if (word.empty() || word[0] == '-' || (may_be_invalid && !IsValidWord(word))) {
+            throw invalid_argument("Query word "s + string(text) + " is invalid");
         }
 
-        return { word, is_minus, IsStopWord(word) };
+        return { word, is_minus, is_stop_word(word) };
     }
 
+    // Words are views into the raw query, sorted and without repeats. Words of quoted phrases are plus words too,
+    // and phrase_words keeps them in query order, each phrase ending at one of phrase_ends
     struct Query {
-        set<string> plus_words;
-        set<string> minus_words;
+        vector<string_view> plus_words;
+        vector<string_view> minus_words;
+        vector<string_view> phrase_words;
+        vector<size_t> phrase_ends;
+        vector<string_view> raw_words;  // tokenizer buffer
+
+        void Clear() {
+            plus_words.clear();
+            minus_words.clear();
+            phrase_words.clear();
+            phrase_ends.clear();
+            raw_words.clear();
+        }
+    };
+
+    // Gives every query a Value whose vectors keep their capacity between calls on the same thread,
+    // so a valid query does not allocate them after warm-up. A query started while another one
+    // is still running on the thread (e.g. from a predicate) gets its own Value.
+    // Value::Clear is called when the buffer is released and must keep the capacity
+    template <typename Value>
+    class ThreadBuffer {
+    public:
+        ThreadBuffer()
+            : is_thread_value_(!thread_value_in_use_)
+            , value_(is_thread_value_ ? thread_value_ : own_value_) {
+            thread_value_in_use_ = true;
+        }
+
+        ~ThreadBuffer() {
+            if (is_thread_value_) {
+                value_.Clear();
+                thread_value_in_use_ = false;
+            }
+        }
+
+        ThreadBuffer(const ThreadBuffer&) = delete;
+        ThreadBuffer& operator=(const ThreadBuffer&) = delete;
+
+        Value& Get() {
+            return value_;
+        }
+
+    private:
+        inline static thread_local Value thread_value_;
+        inline static thread_local bool thread_value_in_use_ = false;
+        Value own_value_;
+        const bool is_thread_value_;
+        Value& value_;
+    };
+
+    using QueryBuffer = ThreadBuffer<Query>;
+
+    // Relevances of the documents matched so far, sorted by id. Every plus word is merged in by one pass
+    // over its postings, so a document sums its relevance in plus word order
+    struct RelevanceAccumulator {
+        vector<pair<int, double>> relevances;
+        vector<pair<int, double>> merged;  // the next relevances while a word is merged
+
+        void Clear() {
+            relevances.clear();
+            merged.clear();
+        }
     };
 
-    Query ParseQuery(const string& text) const {
-        Query result;
-        for (const string& word : SplitIntoWords(text)) {
-            const auto query_word = ParseQueryWord(word);
-            if (!query_word.is_stop) {
-                if (query_word.is_minus) {
-                    result.minus_words.insert(query_word.data);
+    static void SortUnique(vector<string_view>& words) {
+        sort(words.begin(), words.end());
+        words.erase(unique(words.begin(), words.end()), words.end());
+    }
+
+    const Query& ParseQuery(string_view text, QueryBuffer& buffer) const {
+        return ParseQuery(text, buffer, [this](string_view word) {
+            return IsStopWord(word);
+            });
+    }
+
+    // Timed into stats, if any, which also gets the word counts
+    const Query& ParseQuery(string_view text, QueryBuffer& buffer, QueryStats* stats) const {
+        QueryPhaseTimer timer(stats, &QueryStats::parse_time);
+        const Query& query = ParseQuery(text, buffer);
+        if (stats != nullptr) {
+            stats->plus_word_count = query.plus_words.size();
+            stats->minus_word_count = query.minus_words.size();
+        }
+        return query;
+    }
+
+    template <typename StopWordPredicate>
+    static const Query& ParseQuery(string_view text, QueryBuffer& buffer, StopWordPredicate is_stop_word) {
+        PROFILE_SCOPE("ParseQuery");
+        Query& result = buffer.Get();
+        result.Clear();
+        SplitIntoWords(text, result.raw_words);
+        const bool may_be_invalid = HasControlCharacters(text);
+        // A quote opens a phrase at the start of a word and closes it at the end. Stop words are dropped
+        // from phrases like from documents, whose positions count only the other words
+        bool is_in_phrase = false;
+        for (string_view word : result.raw_words) {
+            const bool opens_phrase = !word.empty() && word.front() == '"';
+            if (opens_phrase) {
+                if (is_in_phrase) {
+                    throw invalid_argument("Query phrases cannot be nested"s);
+                }
+                is_in_phrase = true;
+                word.remove_prefix(1);
+            }
+            const bool closes_phrase = !word.empty() && word.back() == '"';
+            if (closes_phrase) {
+                if (!is_in_phrase) {
+                    throw invalid_argument("Query phrase is not opened"s);
+                }
+                word.remove_suffix(1);
+            }
+            // Empty words are invalid, only quotes alone are not
+            if (!word.empty() || !(opens_phrase || closes_phrase)) {
+                const auto query_word = ParseQueryWord(word, is_stop_word, may_be_invalid);
+                if (query_word.is_minus && (is_in_phrase || query_word.data.front() == '"')) {
+                    throw invalid_argument("Query phrase cannot have minus words or be excluded"s);
+                }
+                if (!query_word.is_stop) {
+                    if (query_word.is_minus) {
+                        result.minus_words.push_back(query_word.data);
+                    }
+                    else {
+                        result.plus_words.push_back(query_word.data);
+                        if (is_in_phrase) {
+                            result.phrase_words.push_back(query_word.data);
+                        }
+                    }
                 }
-                else {
-                    result.plus_words.insert(query_word.data);
+            }
+            if (closes_phrase) {
+                is_in_phrase = false;
+                if (result.phrase_words.size() > (result.phrase_ends.empty() ? 0 : result.phrase_ends.back())) {
+                    result.phrase_ends.push_back(result.phrase_words.size());
                 }
             }
         }
+        if (is_in_phrase) {
+            throw invalid_argument("Query phrase is not closed"s);
+        }
+        SortUnique(result.plus_words);
+        SortUnique(result.minus_words);
         return result;
     }
 
-    // Existence required
-    double ComputeWordInverseDocumentFreq(const string& word) const {
-        return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+    template <typename Engine, typename DocumentFilter>
+    vector<Document> FindTopDocumentsForQuery(const Engine& engine, const Query& query, DocumentFilter document_filter) const {
+        return FindTopDocumentsForQuery(engine, query, document_filter, MakeLocalInverseDocumentFreqs());
     }
 
-    template <typename DocumentPredicate>
-    vector<Document> FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const {
-        map<int, double> document_to_relevance;
-        for (const string& word : query.plus_words) {
-            if (word_to_document_freqs_.count(word) == 0) {
+    // inverse_document_freqs(i, term) gives the frequency of the i-th plus word, see MakeLocalInverseDocumentFreqs
+    template <typename ExecutionPolicy, typename DocumentFilter, typename InverseDocumentFreqs>
+    vector<Document> FindTopDocumentsForQuery(const ExecutionPolicy& policy, const Query& query, DocumentFilter document_filter,
+        InverseDocumentFreqs inverse_document_freqs) const {
+        auto matched_documents = FindAllDocuments(policy, query, document_filter, inverse_document_freqs);
+        SelectTopDocuments(matched_documents, max_result_document_count_);
+
+        return matched_documents;
+    }
+
+    // MaxScore: with the terms ordered by the most they can add to a relevance, the shortest prefix whose bounds
+    // together stay below the current threshold is non-essential. Only documents of the other, essential, terms
+    // are visited in id order; the non-essential lists are searched for a document only while its bound still
+    // reaches the threshold. Relevances are summed in plus word order, as by FindAllDocuments, so they are equal bit for bit
+    template <typename DocumentFilter, typename InverseDocumentFreqs>
+    vector<Document> FindTopDocumentsForQuery(const query_engine::MaxScore&, const Query& query, DocumentFilter document_filter,
+        InverseDocumentFreqs inverse_document_freqs) const {
+        PROFILE_SCOPE("MaxScore");
+        struct TermCursor {
+            const Posting* position;
+            const Posting* end;
+            double inverse_document_freq;
+            double max_score;
+
+            bool IsAt(int document_id) const {
+                return position != end && position->document_id == document_id;
+            }
+        };
+        vector<TermCursor> cursors;  // in plus word order
+        for (size_t word_index = 0; word_index < query.plus_words.size(); ++word_index) {
+            const Term* term = FindTerm(query.plus_words[word_index]);
+            if (term == nullptr || term->postings.empty()) {
                 continue;
             }
-            const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-            for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-                const auto& document_data = documents_.at(document_id);
-                if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                    document_to_relevance[document_id] += term_freq * inverse_document_freq;
+            const double inverse_document_freq = inverse_document_freqs(word_index, *term);
+            const Posting* begin = term->postings.data();
+            cursors.push_back({ begin, begin + term->postings.size(), inverse_document_freq, ComputeMaxTermFreq(*term) * inverse_document_freq });
+        }
+        const size_t term_count = cursors.size();
+        vector<size_t> by_bound(term_count);
+        iota(by_bound.begin(), by_bound.end(), 0);
+        sort(by_bound.begin(), by_bound.end(), [&cursors](size_t lhs, size_t rhs) {
+            return cursors[lhs].max_score < cursors[rhs].max_score;
+            });
+        vector<double> bound_sums(term_count + 1, 0.0);  // of the first i terms by bound
+        for (size_t i = 0; i < term_count; ++i) {
+            bound_sums[i + 1] = bound_sums[i] + cursors[by_bound[i]].max_score;
+        }
+
+        ExclusionsBuffer exclusions_buffer;
+        const auto& exclusions = GetDocumentExclusions(query, exclusions_buffer);
+        const size_t max_count = max_result_document_count_;
+        vector<Document> top_documents;  // in ranking order
+        // Relevance a document needs to have a chance to enter the full top. Relevances within RELEVANCE_EPSILON
+        // are ranked by rating, so the threshold is kept a few epsilons lower, which also covers rounding of the bounds
+        double threshold = -numeric_limits<double>::infinity();
+        size_t first_essential = 0;
+        while (true) {
+            while (first_essential < term_count && bound_sums[first_essential + 1] < threshold) {
+                ++first_essential;
+            }
+            int document_id = numeric_limits<int>::max();
+            bool has_document = false;
+            for (size_t i = first_essential; i < term_count; ++i) {
+                const TermCursor& cursor = cursors[by_bound[i]];
+                if (cursor.position != cursor.end) {
+                    document_id = min(document_id, cursor.position->document_id);
+                    has_document = true;
+                }
+            }
+            if (!has_document) {
+                break;
+            }
+
+            double score = 0.0;  // of the terms checked so far, the rest is estimated by bound_sums
+            for (size_t i = first_essential; i < term_count; ++i) {
+                const TermCursor& cursor = cursors[by_bound[i]];
+                if (cursor.IsAt(document_id)) {
+                    score += cursor.position->term_freq * cursor.inverse_document_freq;
+                }
+            }
+            bool may_enter = score + bound_sums[first_essential] >= threshold;
+            for (size_t i = first_essential; may_enter && i > 0; --i) {
+                TermCursor& cursor = cursors[by_bound[i - 1]];
+                cursor.position = lower_bound(cursor.position, cursor.end, document_id,
+                    [](const Posting& lhs, int document_id) { return lhs.document_id < document_id; });
+                if (cursor.IsAt(document_id)) {
+                    score += cursor.position->term_freq * cursor.inverse_document_freq;
+                }
+                may_enter = score + bound_sums[i - 1] >= threshold;
+            }
+
+            if (may_enter && !IsExcluded(exclusions, document_id) && document_filter(document_id)) {
+                // Every cursor is now at the document or past it
+                double relevance = 0.0;
+                for (const TermCursor& cursor : cursors) {
+                    if (cursor.IsAt(document_id)) {
+                        relevance += cursor.position->term_freq * cursor.inverse_document_freq;
+                    }
+                }
+                if (relevance >= threshold) {
+                    const Document document{ document_id, relevance, documents_.at(document_id).rating };
+                    if (top_documents.size() < max_count || IsMoreRelevant(document, top_documents.back())) {
+                        top_documents.insert(upper_bound(top_documents.begin(), top_documents.end(), document, IsMoreRelevant), document);
+                        if (top_documents.size() > max_count) {
+                            top_documents.pop_back();
+                        }
+                        if (top_documents.size() == max_count) {
+                            threshold = top_documents.back().relevance - 3 * RELEVANCE_EPSILON;
+                        }
+                    }
+                }
+            }
+
+            for (size_t i = first_essential; i < term_count; ++i) {
+                TermCursor& cursor = cursors[by_bound[i]];
+                if (cursor.IsAt(document_id)) {
+                    ++cursor.position;
+                }
+            }
+        }
+        return top_documents;
+    }
+
+    // documents is a DocumentStatus or a document predicate
+    template <typename DocumentSelector>
+    vector<Document> FindTopDocumentsWithStats(string_view raw_query, DocumentSelector documents, QueryStats& stats) const {
+        PROFILE_SCOPE("FindTopDocuments");
+        stats = {};
+        QueryBuffer query_buffer;
+        const Query& query = ParseQuery(raw_query, query_buffer, &stats);
+        auto matched_documents = FindAllDocuments(query, MakeDocumentFilter(documents), MakeLocalInverseDocumentFreqs(), &stats);
+        {
+            QueryPhaseTimer timer(&stats, &QueryStats::top_documents_time);
+            SelectTopDocuments(matched_documents, max_result_document_count_);
+        }
+        return matched_documents;
+    }
+
+    // documents is a DocumentStatus or a document predicate
+    template <typename DocumentSelector>
+    SearchPage FindTopDocumentsPageBySelector(string_view raw_query, DocumentSelector documents, size_t page_size,
+        const optional<SearchCursor>& cursor) const {
+        if (page_size == 0) {
+            throw invalid_argument("Page size must be positive"s);
+        }
+        PROFILE_SCOPE("FindTopDocumentsPage");
+        QueryBuffer query_buffer;
+        const Query& query = ParseQuery(raw_query, query_buffer);
+        auto matched_documents = FindAllDocuments(query, MakeDocumentFilter(documents), MakeLocalInverseDocumentFreqs());
+        if (cursor.has_value()) {
+            const Document& last_document = cursor->last_document_;
+            const auto shown_end = remove_if(matched_documents.begin(), matched_documents.end(), [&last_document](const Document& document) {
+                return !IsMoreRelevant(last_document, document);
+                });
+            matched_documents.erase(shown_end, matched_documents.end());
+        }
+        // One more document than fits tells whether there is a next page
+        SelectTopDocuments(matched_documents, page_size + 1);
+
+        SearchPage page;
+        if (matched_documents.size() > page_size) {
+            matched_documents.pop_back();
+            page.next_page = SearchCursor(matched_documents.back());
+        }
+        page.documents = move(matched_documents);
+        return page;
+    }
+
+    tuple<vector<string_view>, DocumentStatus> MatchDocumentForQuery(string_view raw_query, int document_id, QueryStats* stats) const {
+        PROFILE_SCOPE("MatchDocument");
+        QueryBuffer query_buffer;
+        const Query& query = ParseQuery(raw_query, query_buffer, stats);
+
+        vector<string_view> matched_words;
+        {
+            QueryPhaseTimer timer(stats, &QueryStats::score_time);
+            matched_words.reserve(query.plus_words.size());
+            size_t postings_walked = 0;
+            for (const string_view word : query.plus_words) {
+                const auto term_it = word_to_term_id_.find(word);
+                if (term_it == word_to_term_id_.end()) {
+                    continue;
+                }
+                ++postings_walked;
+                if (HasPosting(terms_[term_it->second].postings, document_id)) {
+                    matched_words.push_back(term_it->first);
+                }
+            }
+            if (stats != nullptr) {
+                stats->postings_walked = postings_walked;
+            }
+        }
+        if (IsDocumentExcluded(query, document_id, stats)) {
+            matched_words.clear();
+            if (stats != nullptr) {
+                stats->minus_word_exclusions = 1;
+            }
+        }
+        return { move(matched_words), documents_.at(document_id).status };
+    }
+
+    template <typename ExecutionPolicy>
+    vector<Document> FindTopDocumentsByStatus(const ExecutionPolicy& policy, string_view raw_query, DocumentStatus status) const {
+        PROFILE_SCOPE("FindTopDocuments");
+        QueryBuffer query_buffer;
+        const Query& query = ParseQuery(raw_query, query_buffer);
+        if (!result_cache_.IsEnabled()) {
+            return FindTopDocumentsForQuery(policy, query, MakeStatusFilter(status));
+        }
+
+        string key = MakeResultCacheKey(query, status);
+        if (auto cached_documents = result_cache_.Find(key, GetResultCacheEpoch())) {
+            return move(*cached_documents);
+        }
+        auto matched_documents = FindTopDocumentsForQuery(policy, query, MakeStatusFilter(status));
+        result_cache_.Insert(move(key), GetResultCacheEpoch(), matched_documents, matched_documents.size() * sizeof(Document));
+        return matched_documents;
+    }
+
+    // Results depend on the statuses too. Both epochs only grow, so their sum changes with either
+    uint64_t GetResultCacheEpoch() const {
+        return document_set_epoch_ + document_status_epoch_;
+    }
+
+    // Parsed words are sorted and unique, so queries differing only in word order or repeats share a key
+    string MakeResultCacheKey(const Query& query, DocumentStatus status) const {
+        string key;
+        for (const string_view word : query.plus_words) {
+            key.append(word).push_back(' ');
+        }
+        for (const string_view word : query.minus_words) {
+            key.append("-"sv).append(word).push_back(' ');
+        }
+        for (size_t i = 0, phrase_begin = 0; i < query.phrase_ends.size(); phrase_begin = query.phrase_ends[i++]) {
+            key.push_back('"');
+            for (size_t j = phrase_begin; j < query.phrase_ends[i]; ++j) {
+                key.append(query.phrase_words[j]).push_back(' ');
+            }
+            key.append("\" "sv);
+        }
+        key.append(to_string(static_cast<int>(status))).push_back('/');
+        key.append(to_string(max_result_document_count_));
+        return key;
+    }
+
+    static double ComputeInverseDocumentFreq(int document_count, size_t document_freq) {
+        return log(document_count * 1.0 / document_freq);
+    }
+
+    // Existence required. The logarithm is taken once per term and document set
+    double ComputeWordInverseDocumentFreq(const Term& term) const {
+        return term.inverse_document_freq.Get(document_set_epoch_, [&]() {
+            return ComputeInverseDocumentFreq(GetDocumentCount(), term.postings.size());
+            });
+    }
+
+    // Frequencies of this server's own documents. ShardedSearchServer passes ones of all shards instead
+    auto MakeLocalInverseDocumentFreqs() const {
+        return [this](size_t word_index, const Term& term) {
+            return ComputeWordInverseDocumentFreq(term);
+        };
+    }
+
+    // Existence required. Times the inverse document frequency, it bounds what the term adds to a relevance
+    double ComputeMaxTermFreq(const Term& term) const {
+        return term.max_term_freq.Get(document_set_epoch_, [&term]() {
+            double max_term_freq = 0.0;
+            for (const auto [_, term_freq] : term.postings) {
+                max_term_freq = max(max_term_freq, term_freq);
+            }
+            return max_term_freq;
+            });
+    }
+
+    shared_ptr<const DocumentBitmap> GetDocumentBitmap(const Term& term) const {
+        return term.documents.Get(document_set_epoch_, [&term]() {
+            DocumentBitmap bitmap;
+            for (const auto [document_id, _] : term.postings) {
+                bitmap.Add(document_id);
+            }
+            return bitmap;
+            });
+    }
+
+    // Documents a query rules out, found before scoring: those with a minus word and those lacking a phrase
+    struct DocumentExclusions {
+        vector<shared_ptr<const DocumentBitmap>> minus_word_bitmaps;
+        optional<DocumentBitmap> phrase_documents;  // with every phrase, nullopt for queries without phrases
+
+        void Clear() {
+            minus_word_bitmaps.clear();
+            phrase_documents.reset();
+        }
+    };
+
+    using ExclusionsBuffer = ThreadBuffer<DocumentExclusions>;
+
+    // Filled into the buffer, which also releases the bitmaps when the query is over
+    const DocumentExclusions& GetDocumentExclusions(const Query& query, ExclusionsBuffer& buffer, QueryStats* stats = nullptr) const {
+        QueryPhaseTimer timer(stats, &QueryStats::minus_words_time);
+        DocumentExclusions& exclusions = buffer.Get();
+        exclusions.Clear();
+        for (const string_view word : query.minus_words) {
+            const Term* term = FindTerm(word);
+            if (term != nullptr && !term->postings.empty()) {
+                exclusions.minus_word_bitmaps.push_back(GetDocumentBitmap(*term));
+            }
+        }
+        if (!query.phrase_ends.empty()) {
+            exclusions.phrase_documents = FindPhraseDocuments(query);
+        }
+        return exclusions;
+    }
+
+    // The same check for a single document: minus words through the same cached bitmaps, phrases by binary search
+    // in the positions of their words instead of finding the phrase documents of the whole collection
+    bool IsDocumentExcluded(const Query& query, int document_id, QueryStats* stats) const {
+        QueryPhaseTimer timer(stats, &QueryStats::minus_words_time);
+        for (const string_view word : query.minus_words) {
+            const Term* term = FindTerm(word);
+            if (term != nullptr && !term->postings.empty() && GetDocumentBitmap(*term)->Contains(document_id)) {
+                return true;
+            }
+        }
+        if (!query.phrase_ends.empty()) {
+            CheckPositionalIndex();
+        }
+        for (size_t i = 0, phrase_begin = 0; i < query.phrase_ends.size(); phrase_begin = query.phrase_ends[i++]) {
+            if (!HasPhrase(query.phrase_words, phrase_begin, query.phrase_ends[i], document_id)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool IsExcluded(const DocumentExclusions& exclusions, int document_id) {
+        if (exclusions.phrase_documents.has_value() && !exclusions.phrase_documents->Contains(document_id)) {
+            return true;
+        }
+        return any_of(exclusions.minus_word_bitmaps.begin(), exclusions.minus_word_bitmaps.end(), [document_id](const auto& bitmap) {
+            return bitmap->Contains(document_id);
+            });
+    }
+
+    // Walks the documents of a term in id order. Skip pointers are implicit in the sorted array:
+    // every SKIP_INTERVAL-th id is compared first, so long runs of smaller ids are passed in big steps
+    struct PhraseTermCursor {
+        static constexpr size_t SKIP_INTERVAL = 32;
+
+        const TermPositions* positions;
+        size_t phrase_offset;  // of the word in the phrase
+        size_t index = 0;
+
+        bool IsAtEnd() const {
+            return index == positions->document_ids.size();
+        }
+
+        int GetDocumentId() const {
+            return positions->document_ids[index];
+        }
+
+        // To the first document with id not less than the given one
+        void SkipTo(int document_id) {
+            const auto& document_ids = positions->document_ids;
+            while (index + SKIP_INTERVAL < document_ids.size() && document_ids[index + SKIP_INTERVAL] <= document_id) {
+                index += SKIP_INTERVAL;
+            }
+            while (index < document_ids.size() && document_ids[index] < document_id) {
+                ++index;
+            }
+        }
+
+        // Offsets of the word in the current document
+        const uint32_t* GetPositionsBegin() const {
+            return positions->positions.data() + positions->position_begins[index];
+        }
+
+        const uint32_t* GetPositionsEnd() const {
+            return positions->positions.data() + positions->position_begins[index + 1];
+        }
+    };
+
+    // Documents where the words of every phrase follow one another. Every phrase intersects the document
+    // lists of its words starting from the shortest one, then checks offsets only in the common documents
+    DocumentBitmap FindPhraseDocuments(const Query& query) const {
+        CheckPositionalIndex();
+        vector<int> documents;
+        for (size_t i = 0, phrase_begin = 0; i < query.phrase_ends.size(); phrase_begin = query.phrase_ends[i++]) {
+            vector<int> phrase_documents = FindPhraseDocuments(query.phrase_words, phrase_begin, query.phrase_ends[i]);
+            if (i > 0) {
+                vector<int> common_documents;
+                set_intersection(documents.begin(), documents.end(), phrase_documents.begin(), phrase_documents.end(),
+                    back_inserter(common_documents));
+                phrase_documents = move(common_documents);
+            }
+            documents = move(phrase_documents);
+            if (documents.empty()) {
+                break;
+            }
+        }
+        DocumentBitmap bitmap;
+        for (const int document_id : documents) {
+            bitmap.Add(document_id);
+        }
+        return bitmap;
+    }
+
+    // Ids of the documents with words[begin..end) in a row, sorted
+    vector<int> FindPhraseDocuments(const vector<string_view>& words, size_t begin, size_t end) const {
+        vector<PhraseTermCursor> cursors;
+        for (size_t i = begin; i < end; ++i) {
+            const auto it = word_to_term_id_.find(words[i]);
+            if (it == word_to_term_id_.end() || term_positions_[it->second].document_ids.empty()) {
+                return {};
+            }
+            cursors.push_back({ &term_positions_[it->second], i - begin });
+        }
+        sort(cursors.begin(), cursors.end(), [](const PhraseTermCursor& lhs, const PhraseTermCursor& rhs) {
+            return lhs.positions->document_ids.size() < rhs.positions->document_ids.size();
+            });
+
+        vector<int> documents;
+        PhraseTermCursor& rarest = cursors.front();
+        while (!rarest.IsAtEnd()) {
+            const int document_id = rarest.GetDocumentId();
+            bool is_common = true;
+            for (size_t i = 1; i < cursors.size(); ++i) {
+                cursors[i].SkipTo(document_id);
+                if (cursors[i].IsAtEnd()) {
+                    return documents;
+                }
+                if (cursors[i].GetDocumentId() != document_id) {
+                    rarest.SkipTo(cursors[i].GetDocumentId());
+                    is_common = false;
+                    break;
+                }
+            }
+            if (is_common) {
+                if (HasPhraseAtCursors(cursors)) {
+                    documents.push_back(document_id);
                 }
+                ++rarest.index;
             }
         }
+        return documents;
+    }
+
+    // Whether the document has words[begin..end) in a row
+    bool HasPhrase(const vector<string_view>& words, size_t begin, size_t end, int document_id) const {
+        vector<PhraseTermCursor> cursors;
+        for (size_t i = begin; i < end; ++i) {
+            const auto it = word_to_term_id_.find(words[i]);
+            if (it == word_to_term_id_.end()) {
+                return false;
+            }
+            const TermPositions& positions = term_positions_[it->second];
+            const auto pos = lower_bound(positions.document_ids.begin(), positions.document_ids.end(), document_id);
+            if (pos == positions.document_ids.end() || *pos != document_id) {
+                return false;
+            }
+            cursors.push_back({ &positions, i - begin, static_cast<size_t>(pos - positions.document_ids.begin()) });
+        }
+        // The word with the fewest offsets in the document goes first
+        const auto rarest = min_element(cursors.begin(), cursors.end(), [](const PhraseTermCursor& lhs, const PhraseTermCursor& rhs) {
+            return lhs.GetPositionsEnd() - lhs.GetPositionsBegin() < rhs.GetPositionsEnd() - rhs.GetPositionsBegin();
+            });
+        iter_swap(cursors.begin(), rarest);
+        return HasPhraseAtCursors(cursors);
+    }
 
-        for (const string& word : query.minus_words) {
-            if (word_to_document_freqs_.count(word) == 0) {
+    void CheckPositionalIndex() const {
+        if (!has_positional_index_) {
+            throw invalid_argument("Phrase queries need the positional index"s);
+        }
+    }
+
+    // All cursors are at one document. Every offset of the rarest word fixes where the phrase would start
+    static bool HasPhraseAtCursors(const vector<PhraseTermCursor>& cursors) {
+        const PhraseTermCursor& rarest = cursors.front();
+        for (const uint32_t* position = rarest.GetPositionsBegin(); position != rarest.GetPositionsEnd(); ++position) {
+            if (*position < rarest.phrase_offset) {
+                continue;
+            }
+            const size_t phrase_start = *position - rarest.phrase_offset;
+            const bool has_phrase = all_of(cursors.begin() + 1, cursors.end(), [phrase_start](const PhraseTermCursor& cursor) {
+                return binary_search(cursor.GetPositionsBegin(), cursor.GetPositionsEnd(), phrase_start + cursor.phrase_offset);
+                });
+            if (has_phrase) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // documents is a DocumentStatus or a document predicate
+    template <typename DocumentSelector>
+    auto MakeDocumentFilter(DocumentSelector documents) const {
+        if constexpr (is_same_v<DocumentSelector, DocumentStatus>) {
+            return MakeStatusFilter(documents);
+        }
+        else {
+            return MakePredicateFilter(documents);
+        }
+    }
+
+    // FindAllDocuments takes a filter called with a document id. For user predicates it looks up the document
+    template <typename DocumentPredicate>
+    auto MakePredicateFilter(DocumentPredicate document_predicate) const {
+        return [this, document_predicate](int document_id) mutable {
+            const auto& document_data = documents_.at(document_id);
+            return document_predicate(document_id, document_data.status, document_data.rating);
+        };
+    }
+
+    // Status filter needs only the status bitmap, and not even that when all documents have the status
+    auto MakeStatusFilter(DocumentStatus status) const {
+        static const DocumentBitmap no_documents;
+        const DocumentBitmap& status_documents = IsValidStatus(status) ? status_documents_[static_cast<size_t>(status)] : no_documents;
+        const bool has_all_documents = status_documents.GetCardinality() == documents_.size();
+        return [&status_documents, has_all_documents](int document_id) {
+            return has_all_documents || status_documents.Contains(document_id);
+        };
+    }
+
+    template <typename DocumentFilter, typename InverseDocumentFreqs>
+    vector<Document> FindAllDocuments(const execution::sequenced_policy&, const Query& query, DocumentFilter document_filter,
+        InverseDocumentFreqs inverse_document_freqs) const {
+        return FindAllDocuments(query, document_filter, inverse_document_freqs);
+    }
+
+    // The counters are kept in locals and copied to stats, if any, at the end. After warm-up a query without
+    // phrases allocates only the result: relevances are merged in per-thread buffers
+    template <typename DocumentFilter, typename InverseDocumentFreqs>
+    vector<Document> FindAllDocuments(const Query& query, DocumentFilter document_filter, InverseDocumentFreqs inverse_document_freqs,
+        QueryStats* stats = nullptr) const {
+        PROFILE_SCOPE("FindAllDocuments");
+        ExclusionsBuffer exclusions_buffer;
+        const auto& exclusions = GetDocumentExclusions(query, exclusions_buffer, stats);
+        QueryPhaseTimer timer(stats, &QueryStats::score_time);
+        ThreadBuffer<RelevanceAccumulator> accumulator_buffer;
+        RelevanceAccumulator& accumulator = accumulator_buffer.Get();
+        auto& relevances = accumulator.relevances;
+        auto& merged = accumulator.merged;
+        size_t postings_walked = 0;
+        size_t predicate_calls = 0;
+        size_t minus_word_exclusions = 0;
+        for (size_t word_index = 0; word_index < query.plus_words.size(); ++word_index) {
+            const Term* term = FindTerm(query.plus_words[word_index]);
+            if (term == nullptr || term->postings.empty()) {
                 continue;
             }
-            for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-                document_to_relevance.erase(document_id);
+            const double inverse_document_freq = inverse_document_freqs(word_index, *term);
+            postings_walked += term->postings.size();
+            merged.clear();
+            auto relevance_it = relevances.begin();
+            for (const auto [document_id, term_freq] : term->postings) {
+                if (IsExcluded(exclusions, document_id)) {
+                    ++minus_word_exclusions;
+                    continue;
+                }
+                ++predicate_calls;
+                if (!document_filter(document_id)) {
+                    continue;
+                }
+                for (; relevance_it != relevances.end() && relevance_it->first < document_id; ++relevance_it) {
+                    merged.push_back(*relevance_it);
+                }
+                double relevance = 0.0;
+                if (relevance_it != relevances.end() && relevance_it->first == document_id) {
+                    relevance = (relevance_it++)->second;
+                }
+                merged.emplace_back(document_id, relevance + term_freq * inverse_document_freq);
             }
+            merged.insert(merged.end(), relevance_it, relevances.end());
+            relevances.swap(merged);
+        }
+        // The relevances only grow, so with both buffers this large the next queries merge any word without allocating
+        merged.reserve(relevances.capacity());
+        if (stats != nullptr) {
+            stats->postings_walked = postings_walked;
+            stats->predicate_calls = predicate_calls;
+            stats->minus_word_exclusions = minus_word_exclusions;
+            stats->accumulator_size = relevances.size();
         }
 
         vector<Document> matched_documents;
-        for (const auto [document_id, relevance] : document_to_relevance) {
+        matched_documents.reserve(relevances.size());
+        for (const auto [document_id, relevance] : relevances) {
+            matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
+        }
+        return matched_documents;
+    }
+
+    // Plus words are processed one after another and only their postings are spread across threads,
+    // so every document sums its relevance in the same order as the sequential version
+    template <typename DocumentFilter, typename InverseDocumentFreqs>
+    vector<Document> FindAllDocuments(const execution::parallel_policy& policy, const Query& query, DocumentFilter document_filter,
+        InverseDocumentFreqs inverse_document_freqs) const {
+        PROFILE_SCOPE("FindAllDocuments");
+        ExclusionsBuffer exclusions_buffer;
+        const auto& exclusions = GetDocumentExclusions(query, exclusions_buffer);
+        ConcurrentMap<int, double> document_to_relevance(CONCURRENT_BUCKET_COUNT);
+        for (size_t word_index = 0; word_index < query.plus_words.size(); ++word_index) {
+            const Term* term = FindTerm(query.plus_words[word_index]);
+            if (term == nullptr || term->postings.empty()) {
+                continue;
+            }
+            const double inverse_document_freq = inverse_document_freqs(word_index, *term);
+            for_each(policy, term->postings.begin(), term->postings.end(), [&](const Posting& posting) {
+                if (!IsExcluded(exclusions, posting.document_id) && document_filter(posting.document_id)) {
+                    document_to_relevance[posting.document_id].ref_to_value += posting.term_freq * inverse_document_freq;
+                }
+                });
+        }
+
+        vector<Document> matched_documents;
+        for (const auto [document_id, relevance] : document_to_relevance.BuildOrdinaryMap()) {
             matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
         }
         return matched_documents;
@@ -323,12 +1964,12 @@ void PrintDocument(const Document& document) {
         << "rating = "s << document.rating << " }"s << endl;
 }
 
-void PrintMatchDocumentResult(int document_id, const vector<string>& words, DocumentStatus status) {
+void PrintMatchDocumentResult(int document_id, const vector<string_view>& words, DocumentStatus status) {
     cout << "{ "s
         << "document_id = "s << document_id << ", "s
         << "status = "s << static_cast<int>(status) << ", "s
         << "words ="s;
-    for (const string& word : words) {
+    for (const string_view word : words) {
         cout << ' ' << word;
     }
     cout << "}"s << endl;
@@ -406,34 +2047,88 @@ ostream& operator<<(ostream& out, const IteratorRange<Iterator>& range) {
     return out;
 }
 
+// Pages are made while iterating, so a paginator takes the same memory for any number of pages
 template <typename Iterator>
 class Paginator {
 public:
-    Paginator(Iterator begin, Iterator end, size_t page_size) {
-        for (size_t left = distance(begin, end); left > 0;) {
-            const size_t current_page_size = min(page_size, left);
-            const Iterator current_page_end = next(begin, current_page_size);
-            pages_.push_back({ begin, current_page_end });
+    // A page is returned by value, so to the classic iterator traits this is only an input iterator,
+    // while C++20 algorithms, which allow such references, may take it as a forward one
+    class PageIterator {
+    public:
+        using iterator_category = input_iterator_tag;
+        using iterator_concept = forward_iterator_tag;
+        using value_type = IteratorRange<Iterator>;
+        using difference_type = ptrdiff_t;
+        using pointer = void;
+        using reference = IteratorRange<Iterator>;
+
+        PageIterator() = default;
+
+        PageIterator(Iterator page_begin, size_t left, size_t page_size)
+            : page_begin_(page_begin)
+            , left_(left)
+            , page_size_(page_size) {
+        }
+
+        IteratorRange<Iterator> operator*() const {
+            return { page_begin_, next(page_begin_, min(page_size_, left_)) };
+        }
+
+        PageIterator& operator++() {
+            const size_t current_page_size = min(page_size_, left_);
+            advance(page_begin_, current_page_size);
+            left_ -= current_page_size;
+            return *this;
+        }
+
+        PageIterator operator++(int) {
+            PageIterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        // Pages of one paginator are told apart by the documents left after their start
+        bool operator==(const PageIterator& other) const {
+            return left_ == other.left_;
+        }
 
-            left -= current_page_size;
-            begin = current_page_end;
+        bool operator!=(const PageIterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        Iterator page_begin_{};
+        size_t left_ = 0;  // elements from page_begin_ to the end
+        size_t page_size_ = 0;
+    };
+
+    Paginator(Iterator begin, Iterator end, size_t page_size)
+        : begin_(begin)
+        , end_(end)
+        , element_count_(distance(begin, end))
+        , page_size_(page_size) {
+        if (page_size == 0) {
+            throw invalid_argument("Page size must be positive"s);
         }
     }
 
-    auto begin() const {
-        return pages_.begin();
+    PageIterator begin() const {
+        return { begin_, element_count_, page_size_ };
     }
 
-    auto end() const {
-        return pages_.end();
+    PageIterator end() const {
+        return { end_, 0, page_size_ };
     }
 
     size_t size() const {
-        return pages_.size();
+        return (element_count_ + page_size_ - 1) / page_size_;
     }
 
 private:
-    vector<IteratorRange<Iterator>> pages_;
+    Iterator begin_;
+    Iterator end_;
+    size_t element_count_;
+    size_t page_size_;
 };
 
 template <typename Container>
@@ -555,36 +2250,3 @@ public:
 private:
     Stack<Type> elements_;
 };
-
-/*  !!
-class RequestQueue {
-public:
-    explicit RequestQueue(const SearchServer& search_server) {
-
-    }
-    //  ""    ,      
-    template <typename DocumentPredicate>
-    vector<Document> AddFindRequest(const string& raw_query, DocumentPredicate document_predicate) {
-        //  
-    }
-
-    vector<Document> AddFindRequest(const string& raw_query, DocumentStatus status) {
-        return AddFindRequest(raw_query, []() {; });
-    }
-
-    vector<Document> AddFindRequest(const string& raw_query) {
-        return AddFindRequest(raw_query, DocumentStatus::ACTUAL);
-    }
-
-    int GetNoResultRequests() const {
-        return qr.NoResultRequest;
-    }
-private:
-    struct QueryResult {
-        int NoResultRequest;
-        int YesResultRequest;
-    } qr;
-    deque<QueryResult> requests_;
-    const static int min_in_day_ = 1440;
-};
-*/
\ No newline at end of file
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Binary snapshot of a SearchServer index, laid out so that it can be searched straight from a
+// memory-mapped file (see MappedSearchServer). All sections are 8-byte aligned arrays in host byte order:
+//
+//  stop words       string table: uint64 offsets[count + 1], then the bytes
+//  term words       string table of indexed words, sorted so that a word is found by binary search
+//  posting offsets  uint64[term_count + 1], postings of term i are [offsets[i], offsets[i + 1])
+//  postings         PLAIN: SnapshotPosting[posting_count], sorted by document id within a term;
+//                   COMPRESSED: one PostingCodec.h list per term, offsets are in bytes
+//  documents        SnapshotDocument[document_count], sorted by document id
+//  document ids     int32[document_count] in the order the documents were added
+//
+// The checksum covers everything after the header.
+
+class SnapshotError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+enum class SnapshotPostingEncoding : uint32_t {
+    PLAIN = 0,       // exact term frequencies, 16 bytes per posting
+    COMPRESSED = 1,  // delta-coded ids and 16-bit term frequencies, see PostingCodec.h
+};
+
+struct SnapshotSection {
+    uint64_t offset = 0;  // from the start of the file
+    uint64_t size = 0;    // in bytes
+};
+
+struct SnapshotHeader {
+    static constexpr char MAGIC[8] = { 'S', 'R', 'C', 'H', 'S', 'N', 'A', 'P' };
+    static constexpr uint32_t MIN_SUPPORTED_VERSION = 1;  // version 1 had only plain postings
+    static constexpr uint32_t CURRENT_VERSION = 2;
+    static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order_mark;
+    uint64_t checksum;
+    uint64_t file_size;
+    uint64_t stop_word_count;
+    uint64_t term_count;
+    uint64_t posting_count;
+    uint64_t document_count;
+    int32_t max_result_document_count;
+    SnapshotPostingEncoding posting_encoding;
+    SnapshotSection stop_words;
+    SnapshotSection term_words;
+    SnapshotSection posting_offsets;
+    SnapshotSection postings;
+    SnapshotSection documents;
+    SnapshotSection document_ids;
+};
+
+struct SnapshotPosting {
+    int32_t document_id;
+    uint32_t reserved;
+    double term_freq;
+};
+
+struct SnapshotDocument {
+    int32_t id;
+    int32_t rating;
+    int32_t status;
+    uint32_t reserved;
+};
+
+// FNV-1a over 64-bit words, so that verifying a large snapshot runs at memory speed.
+// Bytes may be fed in pieces of any size, a trailing partial word is zero-padded
+class SnapshotChecksum {
+public:
+    void Update(const char* data, size_t size) {
+        while (size > 0 && pending_size_ > 0) {
+            AddPendingByte(*data++);
+            --size;
+        }
+        for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, data, sizeof(word));
+            AddWord(word);
+        }
+        for (; size > 0; --size) {
+            AddPendingByte(*data++);
+        }
+    }
+
+    uint64_t Get() const {
+        uint64_t hash = hash_;
+        if (pending_size_ > 0) {
+            hash = (hash ^ pending_) * FNV_PRIME;
+        }
+        return hash;
+    }
+
+private:
+    static constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+    static constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+    void AddWord(uint64_t word) {
+        hash_ = (hash_ ^ word) * FNV_PRIME;
+    }
+
+    void AddPendingByte(char byte) {
+        pending_ |= static_cast<uint64_t>(static_cast<unsigned char>(byte)) << (8 * pending_size_);
+        if (++pending_size_ == sizeof(uint64_t)) {
+            AddWord(pending_);
+            pending_ = 0;
+            pending_size_ = 0;
+        }
+    }
+
+    uint64_t hash_ = FNV_OFFSET_BASIS;
+    uint64_t pending_ = 0;
+    size_t pending_size_ = 0;
+};
+
+// Streams sections to a file while computing the checksum; the header is written last
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& path)
+        : output_(path, std::ios::binary | std::ios::trunc) {
+        if (!output_) {
+            throw SnapshotError("Cannot create snapshot file " + path);
+        }
+        const SnapshotHeader placeholder{};
+        output_.write(reinterpret_cast<const char*>(&placeholder), sizeof(placeholder));
+        offset_ = sizeof(placeholder);
+    }
+
+    template <typename Value>
+    SnapshotSection WriteArray(const std::vector<Value>& values) {
+        const uint64_t begin = offset_;
+        Write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(Value));
+        return Finish(begin);
+    }
+
+    // Words are written in the given order
+    template <typename Words>
+    SnapshotSection WriteStringTable(const Words& words) {
+        const uint64_t begin = offset_;
+        std::vector<uint64_t> offsets;
+        offsets.reserve(words.size() + 1);
+        uint64_t bytes = 0;
+        offsets.push_back(bytes);
+        for (const std::string_view word : words) {
+            bytes += word.size();
+            offsets.push_back(bytes);
+        }
+        Write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+        for (const std::string_view word : words) {
+            Write(word.data(), word.size());
+        }
+        return Finish(begin);
+    }
+
+    void Close(SnapshotHeader header) {
+        std::copy(std::begin(SnapshotHeader::MAGIC), std::end(SnapshotHeader::MAGIC), header.magic);
+        header.version = SnapshotHeader::CURRENT_VERSION;
+        header.byte_order_mark = SnapshotHeader::BYTE_ORDER_MARK;
+        header.checksum = checksum_.Get();
+        header.file_size = offset_;
+        output_.seekp(0);
+        output_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        output_.close();
+        if (!output_) {
+            throw SnapshotError("Failed to write snapshot file");
+        }
+    }
+
+private:
+    static constexpr size_t ALIGNMENT = 8;
+
+    void Write(const char* data, size_t size) {
+        output_.write(data, size);
+        checksum_.Update(data, size);
+        offset_ += size;
+    }
+
+    SnapshotSection Finish(uint64_t begin) {
+        const SnapshotSection section{ begin, offset_ - begin };
+        static constexpr char PADDING[ALIGNMENT] = {};
+        Write(PADDING, (ALIGNMENT - offset_ % ALIGNMENT) % ALIGNMENT);
+        return section;
+    }
+
+    std::ofstream output_;
+    SnapshotChecksum checksum_;
+    uint64_t offset_ = 0;
+};
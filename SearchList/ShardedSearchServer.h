@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <execution>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "SearchServer.h"
+#include "OrderedIdList.h"
+
+// Documents spread by id over several SearchServer shards, which are searched in parallel and whose tops
+// are merged. The query is parsed once and relevances use inverse document frequencies of all shards together,
+// so results are the same as of one SearchServer with all the documents
+class ShardedSearchServer {
+public:
+    template <typename StringContainer>
+    ShardedSearchServer(const StringContainer& stop_words, size_t shard_count)
+        : shards_(CheckShardCount(shard_count), SearchServer(stop_words)) {
+    }
+
+    ShardedSearchServer(string_view stop_words_text, size_t shard_count)
+        : shards_(CheckShardCount(shard_count), SearchServer(stop_words_text)) {
+    }
+
+    ShardedSearchServer(const string& stop_words_text, size_t shard_count)
+        : ShardedSearchServer(string_view(stop_words_text), shard_count) {
+    }
+
+    void AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings) {
+        shards_[GetShardIndex(document_id)].AddDocument(document_id, document, status, ratings);
+        document_ids_.PushBack(document_id);
+    }
+
+    // Unknown ids are ignored by the shard and by the id list alike
+    void RemoveDocument(int document_id) {
+        shards_[GetShardIndex(document_id)].RemoveDocument(document_id);
+        document_ids_.Remove(document_id);
+    }
+
+    // document_predicate is called from several threads at once
+    template <typename DocumentPredicate>
+    vector<Document> FindTopDocuments(string_view raw_query, DocumentPredicate document_predicate) const {
+        return FindTopDocumentsInShards(execution::seq, raw_query, [&document_predicate](const SearchServer& shard) {
+            return shard.MakePredicateFilter(document_predicate);
+            });
+    }
+
+    vector<Document> FindTopDocuments(string_view raw_query, DocumentStatus status) const {
+        return FindTopDocumentsInShards(execution::seq, raw_query, [status](const SearchServer& shard) {
+            return shard.MakeStatusFilter(status);
+            });
+    }
+
+    vector<Document> FindTopDocuments(string_view raw_query) const {
+        return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
+    }
+
+    // Every shard is searched by the MaxScore engine
+    template <typename DocumentPredicate>
+    vector<Document> FindTopDocuments(const query_engine::MaxScore& engine, string_view raw_query, DocumentPredicate document_predicate) const {
+        return FindTopDocumentsInShards(engine, raw_query, [&document_predicate](const SearchServer& shard) {
+            return shard.MakePredicateFilter(document_predicate);
+            });
+    }
+
+    vector<Document> FindTopDocuments(const query_engine::MaxScore& engine, string_view raw_query, DocumentStatus status) const {
+        return FindTopDocumentsInShards(engine, raw_query, [status](const SearchServer& shard) {
+            return shard.MakeStatusFilter(status);
+            });
+    }
+
+    vector<Document> FindTopDocuments(const query_engine::MaxScore& engine, string_view raw_query) const {
+        return FindTopDocuments(engine, raw_query, DocumentStatus::ACTUAL);
+    }
+
+    tuple<vector<string_view>, DocumentStatus> MatchDocument(string_view raw_query, int document_id) const {
+        return shards_[GetShardIndex(document_id)].MatchDocument(raw_query, document_id);
+    }
+
+    // Phrase queries need it on every shard, see SearchServer::EnablePositionalIndex
+    void EnablePositionalIndex() {
+        for (SearchServer& shard : shards_) {
+            shard.EnablePositionalIndex();
+        }
+    }
+
+    void SetMaxResultDocumentCount(int count) {
+        for (SearchServer& shard : shards_) {
+            shard.SetMaxResultDocumentCount(count);
+        }
+    }
+
+    int GetMaxResultDocumentCount() const {
+        return shards_.front().GetMaxResultDocumentCount();
+    }
+
+    int GetDocumentCount() const {
+        return static_cast<int>(document_ids_.Size());
+    }
+
+    // In the order the documents were added, O(log n)
+    int GetDocumentId(int index) const {
+        return document_ids_.At(index);
+    }
+
+    size_t GetShardCount() const {
+        return shards_.size();
+    }
+
+    // Shard that holds or would hold the document
+    size_t GetShardIndex(int document_id) const {
+        return static_cast<unsigned int>(document_id) % shards_.size();
+    }
+
+    const SearchServer& GetShard(size_t index) const {
+        return shards_.at(index);
+    }
+
+private:
+    vector<SearchServer> shards_;  // all with the same stop words
+    OrderedIdList document_ids_;  // of all shards, in the order of adding
+
+    static size_t CheckShardCount(size_t shard_count) {
+        if (shard_count == 0) {
+            throw invalid_argument("Shard count must be positive"s);
+        }
+        return shard_count;
+    }
+
+    // Document frequencies of the plus words summed over the shards, turned into the same logarithm SearchServer takes
+    vector<double> ComputeInverseDocumentFreqs(const SearchServer::Query& query) const {
+        vector<double> inverse_document_freqs;
+        inverse_document_freqs.reserve(query.plus_words.size());
+        for (const string_view word : query.plus_words) {
+            size_t document_freq = 0;
+            for (const SearchServer& shard : shards_) {
+                if (const auto* term = shard.FindTerm(word)) {
+                    document_freq += term->postings.size();
+                }
+            }
+            // Words without documents are skipped by every shard
+            inverse_document_freqs.push_back(document_freq == 0 ? 0.0 : SearchServer::ComputeInverseDocumentFreq(GetDocumentCount(), document_freq));
+        }
+        return inverse_document_freqs;
+    }
+
+    // make_filter(shard) gives the document filter of the shard
+    template <typename Engine, typename MakeFilter>
+    vector<Document> FindTopDocumentsInShards(const Engine& engine, string_view raw_query, MakeFilter make_filter) const {
+        SearchServer::QueryBuffer query_buffer;
+        const auto& query = shards_.front().ParseQuery(raw_query, query_buffer);
+        const vector<double> inverse_document_freqs = ComputeInverseDocumentFreqs(query);
+        const auto get_inverse_document_freq = [&inverse_document_freqs](size_t word_index, const auto& term) {
+            return inverse_document_freqs[word_index];
+        };
+
+        vector<vector<Document>> shard_documents(shards_.size());
+        transform(execution::par, shards_.begin(), shards_.end(), shard_documents.begin(), [&](const SearchServer& shard) {
+            return shard.FindTopDocumentsForQuery(engine, query, make_filter(shard), get_inverse_document_freq);
+            });
+
+        vector<Document> matched_documents;
+        for (const auto& documents : shard_documents) {
+            matched_documents.insert(matched_documents.end(), documents.begin(), documents.end());
+        }
+        SelectTopDocuments(matched_documents, GetMaxResultDocumentCount());
+        return matched_documents;
+    }
+};
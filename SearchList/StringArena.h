@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Append-only storage for many short strings: bytes are packed into large blocks,
+// so a stored string costs exactly its length. Stored views stay valid until the arena is destroyed.
+//
+// Copies share the already filled blocks (their bytes never change) and put new strings into
+// blocks of their own, so copying an arena is cheap and both copies may keep growing independently.
+class StringArena {
+public:
+    static const size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+    explicit StringArena(size_t block_size = DEFAULT_BLOCK_SIZE)
+        : block_size_(block_size) {
+    }
+
+    StringArena(const StringArena& other)
+        : blocks_(other.blocks_)
+        , block_size_(other.block_size_)
+        , used_bytes_(other.used_bytes_) {
+        // current_block_ stays null: other may still fill the tail of its last block
+    }
+
+    StringArena& operator=(const StringArena& other) {
+        if (this != &other) {
+            blocks_ = other.blocks_;
+            block_size_ = other.block_size_;
+            used_bytes_ = other.used_bytes_;
+            current_block_ = nullptr;
+        }
+        return *this;
+    }
+
+    StringArena(StringArena&& other) noexcept
+        : blocks_(std::move(other.blocks_))
+        , current_block_(std::exchange(other.current_block_, nullptr))
+        , block_size_(other.block_size_)
+        , used_bytes_(std::exchange(other.used_bytes_, 0)) {
+    }
+
+    StringArena& operator=(StringArena&& other) noexcept {
+        if (this != &other) {
+            blocks_ = std::move(other.blocks_);
+            current_block_ = std::exchange(other.current_block_, nullptr);
+            block_size_ = other.block_size_;
+            used_bytes_ = std::exchange(other.used_bytes_, 0);
+        }
+        return *this;
+    }
+
+    std::string_view Store(std::string_view str) {
+        if (str.empty()) {
+            return {};
+        }
+        if (current_block_ == nullptr || current_block_->capacity - current_block_->size < str.size()) {
+            auto block = std::make_shared<Block>(std::max(block_size_, str.size()));
+            current_block_ = block.get();
+            blocks_.push_back(std::move(block));
+        }
+        char* data = current_block_->data.get() + current_block_->size;
+        std::copy(str.begin(), str.end(), data);
+        current_block_->size += str.size();
+        used_bytes_ += str.size();
+        return { data, str.size() };
+    }
+
+    // Memory held by the blocks, including their unused tails
+    size_t GetAllocatedBytes() const {
+        size_t bytes = 0;
+        for (const auto& block : blocks_) {
+            bytes += block->capacity;
+        }
+        return bytes;
+    }
+
+    // Total length of the stored strings
+    size_t GetUsedBytes() const {
+        return used_bytes_;
+    }
+
+    size_t GetBlockCount() const {
+        return blocks_.size();
+    }
+
+private:
+    struct Block {
+        explicit Block(size_t capacity)
+            : data(std::make_unique<char[]>(capacity))
+            , capacity(capacity) {
+        }
+
+        std::unique_ptr<char[]> data;
+        size_t size = 0;
+        size_t capacity;
+    };
+
+    std::vector<std::shared_ptr<Block>> blocks_;
+    Block* current_block_ = nullptr;  // the block this arena appends to, never shared with a copy
+    size_t block_size_;
+    size_t used_bytes_ = 0;
+};
@@ -32,7 +32,7 @@ void Test3() {
     }
 
 }
-/*
+
 string GenerateWord(mt19937& generator, int max_length) {
     const int length = uniform_int_distribution(1, max_length)(generator);
     string word;
@@ -98,8 +98,6 @@ void Test4()
     TEST(ProcessQueries);
 }
 
-*/
-
 void TestProcessQueriesJoined() {
     SearchServer search_server("and with"s);
 
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <filesystem>
+#include <fstream>
+
 /*
 void UnitTestingSeaarchServer()
 {
@@ -89,4 +92,1225 @@ void Test_2() {
     request_queue.AddFindRequest("sparrow"s);
     cout << "Total empty requests: "s << request_queue.GetNoResultRequests() << endl;
     */
-}
\ No newline at end of file
+}
+
+void TestParallelFindTopDocuments() {
+    SearchServer search_server("and with"s);
+    mt19937 generator;
+    const vector<string> words = { "funny"s, "pet"s, "nasty"s, "rat"s, "curly"s, "hair"s, "not"s, "very"s };
+    for (int id = 0; id < 1000; ++id) {
+        string text;
+        for (int i = 0; i < 8; ++i) {
+            text += words[uniform_int_distribution<int>(0, words.size() - 1)(generator)] + " "s;
+        }
+        search_server.AddDocument(id, text + "and"s, static_cast<DocumentStatus>(id % 3), { id % 7, 1 });
+    }
+
+    for (const string& query : { "nasty rat -not"s, "not very funny nasty pet"s, "curly hair -funny -pet"s, "missing"s }) {
+        const auto sequential = search_server.FindTopDocuments(query);
+        const auto parallel = search_server.FindTopDocuments(execution::par, query);
+        ASSERT_EQUAL(sequential.size(), parallel.size());
+        for (size_t i = 0; i < sequential.size(); ++i) {
+            ASSERT_EQUAL(sequential[i].id, parallel[i].id);
+            ASSERT_EQUAL(sequential[i].relevance, parallel[i].relevance);
+            ASSERT_EQUAL(sequential[i].rating, parallel[i].rating);
+        }
+        ASSERT_EQUAL(search_server.FindTopDocuments(query, DocumentStatus::BANNED).size(),
+            search_server.FindTopDocuments(execution::par, query, DocumentStatus::BANNED).size());
+    }
+}
+
+void TestMaxResultDocumentCount() {
+    SearchServer search_server("and with"s);
+    for (int id = 0; id < 100; ++id) {
+        search_server.AddDocument(id, "curly cat with tail "s + to_string(id), DocumentStatus::ACTUAL, { id % 10 });
+    }
+
+    ASSERT_EQUAL(search_server.FindTopDocuments("curly cat"s).size(), static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT));
+
+    search_server.SetMaxResultDocumentCount(50);
+    const auto documents = search_server.FindTopDocuments("curly cat"s);
+    ASSERT_EQUAL(documents.size(), 50u);
+    ASSERT(is_sorted(documents.begin(), documents.end(), IsMoreRelevant));
+    // Relevances are equal, so ratings decide and ids break the remaining ties
+    ASSERT_EQUAL(documents.front().rating, 9);
+    ASSERT_EQUAL(documents.front().id, 9);
+    ASSERT_EQUAL(documents.back().rating, 5);
+
+    search_server.SetMaxResultDocumentCount(1000);
+    ASSERT_EQUAL(search_server.FindTopDocuments("curly cat"s).size(), 100u);
+}
+
+void TestRemoveDocument() {
+    SearchServer search_server("and with"s);
+    search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    search_server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, { 1, 2 });
+    search_server.AddDocument(3, "nasty rat with curly hair"s, DocumentStatus::ACTUAL, { 1, 2, 8 });
+
+    const auto& word_frequencies = search_server.GetWordFrequencies(2);
+    ASSERT_EQUAL(word_frequencies.size(), 4u);
+    ASSERT_EQUAL(word_frequencies.at("curly"sv), 0.25);
+    ASSERT(search_server.GetWordFrequencies(42).empty());
+
+    search_server.RemoveDocument(2);
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 2);
+    ASSERT(search_server.GetWordFrequencies(2).empty());
+    const auto documents = search_server.FindTopDocuments("curly pet"s);
+    ASSERT_EQUAL(documents.size(), 2u);
+    ASSERT_EQUAL(documents[0].id, 1);
+    ASSERT_EQUAL(documents[1].id, 3);
+
+    search_server.RemoveDocument(execution::par, 3);
+    search_server.RemoveDocument(execution::seq, 42);
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 1);
+    ASSERT_EQUAL(search_server.GetDocumentId(0), 1);
+    ASSERT(search_server.FindTopDocuments("curly hair"s).empty());
+
+    // A removed id can be used again
+    search_server.AddDocument(2, "curly hair"s, DocumentStatus::ACTUAL, { 1 });
+    ASSERT_EQUAL(search_server.FindTopDocuments("curly"s).size(), 1u);
+    ASSERT_EQUAL(search_server.GetDocumentId(1), 2);
+
+    // Ids keep the order of adding through many removals
+    vector<int> expected_ids = { 1, 2 };
+    for (int id = 1000; id > 500; --id) {
+        search_server.AddDocument(id, "pet"s, DocumentStatus::ACTUAL, { 1 });
+        expected_ids.push_back(id);
+    }
+    for (int id = 1000; id > 500; id -= id % 3 == 0 ? 1 : 2) {
+        search_server.RemoveDocument(id);
+        expected_ids.erase(find(expected_ids.begin(), expected_ids.end(), id));
+    }
+    ASSERT_EQUAL(search_server.GetDocumentCount(), static_cast<int>(expected_ids.size()));
+    for (size_t i = 0; i < expected_ids.size(); ++i) {
+        ASSERT_EQUAL(search_server.GetDocumentId(static_cast<int>(i)), expected_ids[i]);
+    }
+    try {
+        search_server.GetDocumentId(static_cast<int>(expected_ids.size()));
+        ASSERT_HINT(false, "out_of_range expected"s);
+    }
+    catch (const out_of_range&) {
+    }
+
+    // A batch removes the same as one by one, positions included
+    SearchServer one_by_one_server("and with"s);
+    SearchServer batch_server("and with"s);
+    one_by_one_server.EnablePositionalIndex();
+    batch_server.EnablePositionalIndex();
+    const vector<string> texts = { "funny pet and nasty rat"s, "nasty rat with curly hair"s, "curly pet"s, "funny pet rat"s };
+    for (int id = 0; id < 40; ++id) {
+        one_by_one_server.AddDocument(id, texts[id % texts.size()], DocumentStatus::ACTUAL, { id });
+        batch_server.AddDocument(id, texts[id % texts.size()], DocumentStatus::ACTUAL, { id });
+    }
+    const vector<int> removed_ids = { 3, 17, 4, 42, 3, 25, 0, 39 };
+    for (const int id : removed_ids) {
+        one_by_one_server.RemoveDocument(id);
+    }
+    batch_server.RemoveDocuments(removed_ids);
+    ASSERT_EQUAL(batch_server.GetDocumentCount(), 34);
+    for (int index = 0; index < batch_server.GetDocumentCount(); ++index) {
+        ASSERT_EQUAL(batch_server.GetDocumentId(index), one_by_one_server.GetDocumentId(index));
+    }
+    for (const string query : { "curly pet"s, "\"nasty rat\" -hair"s, "\"funny pet\""s }) {
+        const auto expected = one_by_one_server.FindTopDocuments(query, [](int, DocumentStatus, int) { return true; });
+        const auto documents = batch_server.FindTopDocuments(query, [](int, DocumentStatus, int) { return true; });
+        ASSERT_EQUAL(documents.size(), expected.size());
+        for (size_t i = 0; i < documents.size(); ++i) {
+            ASSERT_EQUAL(documents[i].id, expected[i].id);
+            ASSERT(abs(documents[i].relevance - expected[i].relevance) < 1e-9);
+        }
+    }
+}
+
+void TestRemoveDuplicates() {
+    SearchServer search_server("and with"s);
+    search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    search_server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, { 1, 2 });
+    // Same words as 2, differs only in stop words and repeats
+    search_server.AddDocument(3, "funny pet with curly hair and hair"s, DocumentStatus::ACTUAL, { 1, 2 });
+    // Same words as 1 in another order
+    search_server.AddDocument(4, "nasty rat funny pet"s, DocumentStatus::ACTUAL, { 1, 2 });
+    // Subset of 1 is not a duplicate
+    search_server.AddDocument(5, "funny pet"s, DocumentStatus::ACTUAL, { 1, 2 });
+    // Lower id is kept even when added later
+    search_server.AddDocument(0, "curly hair funny pet"s, DocumentStatus::ACTUAL, { 1, 2 });
+
+    const auto report = RemoveDuplicates(search_server);
+    ASSERT_EQUAL(report.removed_document_ids, vector<int>({ 2, 3, 4 }));
+    ASSERT_EQUAL(report.removed_postings, 12u);
+    ASSERT(report.reclaimed_bytes > 0);
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 3);
+    ASSERT(RemoveDuplicates(search_server).removed_document_ids.empty());
+}
+
+void TestMatchDocumentWords() {
+    SearchServer search_server("and with"s);
+    search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::BANNED, { 7, 2, 7 });
+
+    vector<string_view> words;
+    {
+        // Matched words must not point into the query text
+        string query = "rat funny with curly funny"s;
+        words = get<0>(search_server.MatchDocument(query, 1));
+        fill(query.begin(), query.end(), ' ');
+    }
+    ASSERT_EQUAL(words.size(), 2u);
+    ASSERT_EQUAL(words[0], "funny"sv);
+    ASSERT_EQUAL(words[1], "rat"sv);
+
+    const auto [minus_words, status] = search_server.MatchDocument("funny -nasty"sv, 1);
+    ASSERT(minus_words.empty());
+    ASSERT(status == DocumentStatus::BANNED);
+}
+
+void TestCompactTermStorage() {
+    SearchServer search_server("and with"s);
+    search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    search_server.AddDocument(2, "curly dog with fancy collar"s, DocumentStatus::ACTUAL, { 1, 2 });
+    search_server.AddDocument(3, "nasty dog"s, DocumentStatus::ACTUAL, { 1, 2, 8 });
+
+    const SearchServer copy = search_server;
+    search_server.RemoveDocument(2);
+    auto stats = search_server.GetTermStorageStats();
+    ASSERT_EQUAL(stats.term_count, 8u);
+    ASSERT_EQUAL(stats.live_term_count, 5u);
+    ASSERT_EQUAL(stats.live_bytes, "funnypetnastyratdog"s.size());
+    ASSERT_EQUAL(stats.used_bytes, "funnypetnastyratcurlydogfancycollar"s.size());
+
+    search_server.CompactTermStorage();
+    stats = search_server.GetTermStorageStats();
+    ASSERT_EQUAL(stats.term_count, 5u);
+    ASSERT_EQUAL(stats.used_bytes, stats.live_bytes);
+    ASSERT_EQUAL(search_server.GetWordFrequencies(3).count("dog"sv), 1u);
+    ASSERT_EQUAL(search_server.FindTopDocuments("dog"s).size(), 1u);
+    ASSERT(search_server.FindTopDocuments("collar"s).empty());
+
+    // The copy shares the old arena blocks and is not affected by the compaction
+    ASSERT_EQUAL(copy.FindTopDocuments("collar dog"s).size(), 2u);
+    ASSERT_EQUAL(get<0>(copy.MatchDocument("fancy"s, 2)).front(), "fancy"sv);
+}
+
+void TestInverseDocumentFreqCache() {
+    SearchServer search_server(""s);
+    search_server.AddDocument(1, "cat dog"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(2, "dog"s, DocumentStatus::ACTUAL, { 1 });
+    ASSERT_EQUAL(search_server.FindTopDocuments("cat"s).front().relevance, 0.5 * log(2.0 / 1));
+
+    // Cached values must follow every change of the document set
+    search_server.AddDocument(3, "bird"s, DocumentStatus::ACTUAL, { 1 });
+    ASSERT_EQUAL(search_server.FindTopDocuments("cat"s).front().relevance, 0.5 * log(3.0 / 1));
+    search_server.AddDocument(4, "cat"s, DocumentStatus::ACTUAL, { 1 });
+    ASSERT_EQUAL(search_server.FindTopDocuments(execution::par, "cat"s).back().relevance, 0.5 * log(4.0 / 2));
+    search_server.RemoveDocument(3);
+    ASSERT_EQUAL(search_server.FindTopDocuments("cat"s).back().relevance, 0.5 * log(3.0 / 2));
+}
+
+void TestResultCache() {
+    SearchServer search_server("and with"s);
+    search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    search_server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, { 1, 2 });
+    search_server.EnableResultCache(2, 1 << 20);
+
+    const auto documents = search_server.FindTopDocuments("curly funny"s);
+    // Same parsed query in another spelling
+    ASSERT_EQUAL(search_server.FindTopDocuments("funny curly funny"s).size(), documents.size());
+    auto stats = search_server.GetResultCacheStats();
+    ASSERT_EQUAL(stats.hits, 1u);
+    ASSERT_EQUAL(stats.misses, 1u);
+    ASSERT_EQUAL(stats.entries, 1u);
+
+    // Status is a part of the key
+    ASSERT(search_server.FindTopDocuments("curly funny"s, DocumentStatus::BANNED).empty());
+    // Over the limit of 2 entries
+    search_server.FindTopDocuments("nasty"s);
+    stats = search_server.GetResultCacheStats();
+    ASSERT_EQUAL(stats.entries, 2u);
+    ASSERT_EQUAL(stats.evictions, 1u);
+
+    // Any change of the document set invalidates cached results
+    search_server.AddDocument(3, "curly curly"s, DocumentStatus::ACTUAL, { 9 });
+    ASSERT_EQUAL(search_server.FindTopDocuments("curly funny"s).front().id, 3);
+    ASSERT_EQUAL(search_server.GetResultCacheStats().hits, 1u);
+    ASSERT_EQUAL(search_server.FindTopDocuments(execution::par, "funny curly"s).front().id, 3);
+    ASSERT_EQUAL(search_server.GetResultCacheStats().hits, 2u);
+}
+
+void TestRequestQueue() {
+    SearchServer search_server("and in at"s);
+    search_server.AddDocument(1, "curly cat curly tail"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    search_server.AddDocument(2, "curly dog and fancy collar"s, DocumentStatus::ACTUAL, { 1, 2, 3 });
+    search_server.AddDocument(3, "big cat fancy collar "s, DocumentStatus::ACTUAL, { 1, 2, 8 });
+
+    RequestQueue request_queue(search_server, 4);
+    request_queue.AddFindRequest("empty request"s);
+    request_queue.AddFindRequest("curly dog"s);
+    request_queue.AddFindRequest("big collar"s, DocumentStatus::BANNED);
+    auto stats = request_queue.GetWindowStats();
+    ASSERT_EQUAL(stats.requests, 3u);
+    ASSERT_EQUAL(stats.no_result_requests, 2u);
+    ASSERT_EQUAL(stats.total_results, 2u);
+    ASSERT(stats.max_latency <= stats.total_latency);
+
+    // The two oldest requests leave the window of 4
+    request_queue.AddFindRequest("collar"s);
+    request_queue.AddFindRequest("cat"s, [](int document_id, DocumentStatus status, int rating) {
+        return document_id == 1;
+        });
+    request_queue.AddFindRequest("tail"s);
+    stats = request_queue.GetWindowStats();
+    ASSERT_EQUAL(stats.requests, 4u);
+    ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1);
+    ASSERT_EQUAL(stats.total_results, 4u);
+    ASSERT_EQUAL(stats.GetMeanResults(), 1.0);
+}
+
+void TestAddDocuments() {
+    SearchServer search_server("and with"s);
+    search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+
+    const vector<DocumentInput> documents = {
+        { 3, "nasty rat with curly hair"s, DocumentStatus::ACTUAL, { 1, 2, 8 } },
+        { 2, "funny pet with curly hair"s, DocumentStatus::BANNED, { 1, 2 } },
+        { 4, "curly curly dog"s, DocumentStatus::ACTUAL, {} },
+    };
+    search_server.AddDocuments(documents);
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 4);
+    ASSERT_EQUAL(search_server.GetDocumentId(1), 3);
+    ASSERT_EQUAL(search_server.GetWordFrequencies(4).at("curly"sv), 2.0 / 3);
+    const auto found = search_server.FindTopDocuments("curly"s);
+    ASSERT_EQUAL(found.size(), 2u);
+    ASSERT_EQUAL(found[0].id, 4);
+    ASSERT_EQUAL(found[1].id, 3);
+    ASSERT_EQUAL(search_server.FindTopDocuments("curly"s, DocumentStatus::BANNED).front().id, 2);
+
+    const auto expect_error = [&](const vector<DocumentInput>& batch, int document_id, size_t index) {
+        try {
+            search_server.AddDocuments(execution::seq, batch);
+            ASSERT_HINT(false, "DocumentLoadError expected"s);
+        }
+        catch (const DocumentLoadError& e) {
+            ASSERT_EQUAL(e.GetDocumentId(), document_id);
+            ASSERT_EQUAL(e.GetIndex(), index);
+        }
+        ASSERT_EQUAL(search_server.GetDocumentCount(), 4);
+    };
+    expect_error({ { 5, "cat"s, DocumentStatus::ACTUAL, {} }, { 6, "c\x12t"s, DocumentStatus::ACTUAL, {} } }, 6, 1);
+    expect_error({ { 5, "cat"s, DocumentStatus::ACTUAL, {} }, { 5, "dog"s, DocumentStatus::ACTUAL, {} } }, 5, 1);
+    expect_error({ { 3, "cat"s, DocumentStatus::ACTUAL, {} }, { 6, "c\x12t"s, DocumentStatus::ACTUAL, {} } }, 3, 0);
+    expect_error({ { -1, "cat"s, DocumentStatus::ACTUAL, {} } }, -1, 0);
+}
+
+void TestMappedSearchServer() {
+    SearchServer search_server("and with"s);
+    search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    search_server.AddDocument(5, "funny pet with curly hair"s, DocumentStatus::BANNED, { 1, 2 });
+    search_server.AddDocument(3, "curly curly dog"s, DocumentStatus::ACTUAL, {});
+    search_server.AddDocument(2, "big rat"s, DocumentStatus::ACTUAL, { 3 });
+    search_server.RemoveDocument(2);
+    search_server.SetMaxResultDocumentCount(2);
+
+    const string path = (filesystem::temp_directory_path() / "search_server_test.snapshot"s).string();
+    search_server.SaveSnapshot(path);
+    {
+        const MappedSearchServer mapped_server(path);
+        ASSERT_EQUAL(mapped_server.GetDocumentCount(), 3);
+        ASSERT_EQUAL(mapped_server.GetDocumentId(2), 3);
+        ASSERT_EQUAL(mapped_server.GetMaxResultDocumentCount(), 2);
+        for (const string query : { "funny curly"s, "rat -dog"s, "curly pet with -nasty"s, "big"s, "-funny"s }) {
+            for (const auto status : { DocumentStatus::ACTUAL, DocumentStatus::BANNED }) {
+                const auto expected = search_server.FindTopDocuments(query, status);
+                const auto found = mapped_server.FindTopDocuments(query, status);
+                ASSERT_EQUAL(found.size(), expected.size());
+                for (size_t i = 0; i < found.size(); ++i) {
+                    ASSERT_EQUAL(found[i].id, expected[i].id);
+                    ASSERT_EQUAL(found[i].relevance, expected[i].relevance);
+                    ASSERT_EQUAL(found[i].rating, expected[i].rating);
+                }
+            }
+        }
+        const auto [words, status] = mapped_server.MatchDocument("hair funny -rat"s, 5);
+        ASSERT_EQUAL(words.size(), 2u);
+        ASSERT_EQUAL(words[0], "funny"sv);
+        ASSERT(status == DocumentStatus::BANNED);
+        ASSERT(get<0>(mapped_server.MatchDocument("funny -rat"s, 1)).empty());
+        try {
+            mapped_server.FindTopDocuments("funny --pet"s);
+            ASSERT_HINT(false, "invalid_argument expected"s);
+        }
+        catch (const invalid_argument&) {
+        }
+    }
+
+    // Corrupt the last byte of the file
+    {
+        fstream file(path, ios::binary | ios::in | ios::out);
+        file.seekp(-1, ios::end);
+        file.put('\x7f');
+    }
+    try {
+        MappedSearchServer mapped_server(path);
+        ASSERT_HINT(false, "SnapshotError expected"s);
+    }
+    catch (const SnapshotError&) {
+    }
+    MappedSearchServer unchecked_server(path, SnapshotVerification::HEADER_ONLY);
+    ASSERT_EQUAL(unchecked_server.GetDocumentCount(), 3);
+
+    // A posting of a document the snapshot does not have, found only by a query without the checksum
+    {
+        fstream file(path, ios::binary | ios::in | ios::out);
+        SnapshotHeader header;
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        const int32_t unknown_id = 999999;
+        file.seekp(static_cast<streamoff>(header.postings.offset));
+        file.write(reinterpret_cast<const char*>(&unknown_id), sizeof(unknown_id));
+    }
+    try {
+        MappedSearchServer(path, SnapshotVerification::HEADER_ONLY).FindTopDocuments("curly"s);
+        ASSERT_HINT(false, "SnapshotError expected"s);
+    }
+    catch (const SnapshotError&) {
+    }
+    filesystem::remove(path);
+}
+
+void TestCompressedPostings() {
+    struct TestPosting {
+        int document_id;
+        double term_freq;
+    };
+    mt19937 generator(7);
+    // Both block decoders on every bit width
+    for (uint32_t width = 0; width <= 32; ++width) {
+        vector<uint32_t> deltas(POSTING_BLOCK_SIZE);
+        for (uint32_t& delta : deltas) {
+            delta = width == 32 ? static_cast<uint32_t>(generator()) : static_cast<uint32_t>(generator() % (uint64_t{ 1 } << width));
+        }
+        vector<char> packed;
+        posting_codec_detail::PackBlock(deltas.data(), width, packed);
+        vector<uint32_t> unpacked(POSTING_BLOCK_SIZE);
+        vector<uint32_t> document_ids(POSTING_BLOCK_SIZE);
+        if (width > 0) {
+            posting_codec_detail::UnpackBlockScalar(packed.data(), width, unpacked.data());
+            ASSERT(unpacked == deltas);
+        }
+        posting_codec_detail::DecodeBlock(packed.data(), width, 5, document_ids.data());
+        uint32_t document_id = 5;
+        for (size_t i = 0; i < POSTING_BLOCK_SIZE; ++i) {
+            document_id += deltas[i];
+            ASSERT_EQUAL(document_ids[i], document_id);
+        }
+    }
+
+    // Several full blocks of growing widths and a varint tail
+    vector<TestPosting> postings;
+    int64_t document_id = 0;
+    for (int i = 0; i < 1000; ++i) {
+        document_id += 1 + generator() % (1u << (i % 31)) / 2;
+        if (document_id > numeric_limits<int>::max()) {
+            break;
+        }
+        postings.push_back({ static_cast<int>(document_id), 1.0 / (1 + generator() % 100) });
+    }
+    vector<char> encoded;
+    EncodePostings(postings, encoded);
+
+    const char* const encoded_end = encoded.data() + encoded.size();
+    size_t index = 0;
+    ForEachPosting(encoded.data(), encoded_end, [&](int document_id, double term_freq) {
+        ASSERT(index < postings.size());
+        ASSERT_EQUAL(document_id, postings[index].document_id);
+        ASSERT(abs(term_freq - postings[index].term_freq) <= 1.0 / 65535);
+        ++index;
+        });
+    ASSERT_EQUAL(index, postings.size());
+    ASSERT_EQUAL(PostingBlockReader(encoded.data(), encoded_end).GetPostingCount(), postings.size());
+
+    // Damaged lists throw instead of reading past their end
+    const auto expect_snapshot_error = [](const vector<char>& damaged) {
+        try {
+            ForEachPosting(damaged.data(), damaged.data() + damaged.size(), [](int, double) {});
+            ASSERT_HINT(false, "SnapshotError expected"s);
+        }
+        catch (const SnapshotError&) {
+        }
+    };
+    for (const size_t size : { size_t{ 0 }, size_t{ 10 }, size_t{ 17 }, encoded.size() / 2, encoded.size() - 1 }) {
+        expect_snapshot_error(vector<char>(encoded.begin(), encoded.begin() + size));
+    }
+    vector<char> damaged = encoded;
+    damaged[16] = 33;  // bit width of the first block
+    expect_snapshot_error(damaged);
+    vector<char> tail_only;
+    EncodePostings(vector<TestPosting>{ { 1, 1.0 } }, tail_only);
+    tail_only.insert(tail_only.begin() + 16, 5, '\x80');  // the varint of the only delta never ends
+    expect_snapshot_error(tail_only);
+
+    SearchServer search_server("and with"s);
+    search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    search_server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::BANNED, { 1, 2 });
+    for (int id = 3; id < 500; ++id) {
+        search_server.AddDocument(id, id % 3 == 0 ? "curly dog"s : "funny curly cat cat"s, DocumentStatus::ACTUAL, { id });
+    }
+    const string path = (filesystem::temp_directory_path() / "search_server_test_compressed.snapshot"s).string();
+    search_server.SaveSnapshot(path, SnapshotPostingEncoding::COMPRESSED);
+    {
+        const MappedSearchServer mapped_server(path);
+        for (const string query : { "funny curly"s, "cat -dog"s, "curly pet with -nasty"s, "rat"s }) {
+            const auto expected = search_server.FindTopDocuments(query);
+            const auto found = mapped_server.FindTopDocuments(query);
+            ASSERT_EQUAL(found.size(), expected.size());
+            for (size_t i = 0; i < found.size(); ++i) {
+                ASSERT_EQUAL(found[i].id, expected[i].id);
+                ASSERT(abs(found[i].relevance - expected[i].relevance) < 1e-4);
+            }
+        }
+        ASSERT_EQUAL(get<0>(mapped_server.MatchDocument("dog cat -rat"s, 498)).size(), 1u);
+        ASSERT(get<0>(mapped_server.MatchDocument("dog cat -cat"s, 499)).empty());
+    }
+    filesystem::remove(path);
+}
+
+void TestTextScan() {
+    // The splitting the tokenizer must reproduce
+    const auto split_at_spaces = [](string_view text) {
+        vector<string_view> words;
+        for (size_t space = text.find(' '); space != text.npos; space = text.find(' ')) {
+            words.push_back(text.substr(0, space));
+            text.remove_prefix(space + 1);
+        }
+        words.push_back(text);
+        return words;
+    };
+    for (const string text : { ""s, " "s, "cat"s, "  funny  pet "s, string(200, ' '), "a"s + string(63, ' ') + "b"s }) {
+        ASSERT(SplitIntoWords(text) == split_at_spaces(text));
+    }
+
+    mt19937 generator(11);
+    const string alphabet = "ab -\t\x7f\x80\xff"s;
+    vector<TextScanIsa> isas = { TextScanIsa::SCALAR };
+    if (GetBestTextScanIsa() != TextScanIsa::SCALAR) {
+        isas.push_back(TextScanIsa::SSE2);
+    }
+    if (GetBestTextScanIsa() == TextScanIsa::AVX2) {
+        isas.push_back(TextScanIsa::AVX2);
+    }
+    for (size_t length = 0; length < 300; ++length) {
+        string text;
+        for (size_t i = 0; i < length; ++i) {
+            // Control characters are rare, so that most texts have none
+            text += generator() % 64 == 0 ? '\x01' : alphabet[generator() % alphabet.size()];
+        }
+        ASSERT(SplitIntoWords(text) == split_at_spaces(text));
+        const bool has_control = any_of(text.begin(), text.end(), [](char c) {
+            return c >= '\0' && c < ' ';
+            });
+        for (const TextScanIsa isa : isas) {
+            const auto& kernels = GetTextScanKernels(isa);
+            ASSERT_EQUAL(kernels.has_control_characters(text.data(), text.size()), has_control);
+            vector<uint64_t> bits((length + 63) / 64, ~uint64_t{ 0 });
+            kernels.mark_spaces(text.data(), text.size(), bits.data());
+            for (size_t i = 0; i < length; ++i) {
+                ASSERT_EQUAL((bits[i / 64] >> (i % 64)) & 1, static_cast<uint64_t>(text[i] == ' '));
+            }
+            if (length % 64 != 0) {
+                ASSERT_EQUAL(bits.back() >> (length % 64), 0u);
+            }
+        }
+    }
+
+    // Error messages still name the first invalid word
+    SearchServer search_server("and"s);
+    try {
+        search_server.AddDocument(1, "funny p\x12t and r\x13t"s, DocumentStatus::ACTUAL, {});
+        ASSERT_HINT(false, "invalid_argument expected"s);
+    }
+    catch (const invalid_argument& e) {
+        ASSERT_EQUAL(string(e.what()), "Word p\x12t is invalid"s);
+    }
+    try {
+        search_server.FindTopDocuments("funny --pet r\x12t"s);
+        ASSERT_HINT(false, "invalid_argument expected"s);
+    }
+    catch (const invalid_argument& e) {
+        ASSERT_EQUAL(string(e.what()), "Query word --pet is invalid"s);
+    }
+}
+
+void TestDocumentBitmap() {
+    DocumentBitmap bitmap;
+    set<int> expected;
+    mt19937 generator(5);
+    // Sparse ids over many containers and one container dense enough to become a bitmap
+    for (int i = 0; i < 20'000; ++i) {
+        const int document_id = i % 2 == 0 ? static_cast<int>(generator() % 10'000'000) : 70'000 + static_cast<int>(generator() % 9'000);
+        bitmap.Add(document_id);
+        expected.insert(document_id);
+    }
+    ASSERT_EQUAL(bitmap.GetCardinality(), expected.size());
+    for (int document_id = 69'000; document_id < 80'000; ++document_id) {
+        ASSERT_EQUAL(bitmap.Contains(document_id), expected.count(document_id) > 0);
+    }
+    for (const int document_id : expected) {
+        ASSERT(bitmap.Contains(document_id));
+    }
+    ASSERT(!DocumentBitmap().Contains(0));
+    // Emptying the dense container turns it back into an array and finally drops it
+    for (int document_id = 70'000; document_id < 79'000; ++document_id) {
+        bitmap.Remove(document_id);
+        expected.erase(document_id);
+        if (document_id % 1000 == 0) {
+            ASSERT_EQUAL(bitmap.GetCardinality(), expected.size());
+            ASSERT(!bitmap.Contains(document_id));
+            ASSERT_EQUAL(bitmap.Contains(document_id + 500), expected.count(document_id + 500) > 0);
+        }
+    }
+    for (const int document_id : expected) {
+        ASSERT(bitmap.Contains(document_id));
+    }
+
+    SearchServer search_server("and with"s);
+    search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    search_server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, { 1, 2 });
+    ASSERT_EQUAL(search_server.FindTopDocuments("pet -rat"s).size(), 1u);
+    // Cached minus word bitmaps follow changes of the documents
+    search_server.AddDocument(3, "curly rat"s, DocumentStatus::ACTUAL, { 3 });
+    ASSERT(search_server.FindTopDocuments("curly -rat"s).front().id == 2);
+    ASSERT(get<0>(search_server.MatchDocument("curly -rat"s, 3)).empty());
+    search_server.RemoveDocument(1);
+    search_server.AddDocument(1, "nasty pet"s, DocumentStatus::ACTUAL, { 3 });
+    ASSERT_EQUAL(search_server.FindTopDocuments(execution::par, "pet -rat"s).size(), 2u);
+    ASSERT_EQUAL(get<0>(search_server.MatchDocument("pet -rat"s, 1)).size(), 1u);
+}
+
+void TestSetDocumentStatus() {
+    SearchServer search_server("and with"s);
+    search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    search_server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, { 1, 2 });
+    search_server.AddDocuments(vector<DocumentInput>{ { 3, "curly rat"s, DocumentStatus::BANNED, { 3 } } });
+    search_server.EnableResultCache(16, 1 << 20);
+    ASSERT_EQUAL(search_server.FindTopDocuments("curly rat"s).size(), 2u);
+    ASSERT_EQUAL(search_server.FindTopDocuments("curly rat"s, DocumentStatus::BANNED).front().id, 3);
+
+    search_server.SetDocumentStatus(2, DocumentStatus::BANNED);
+    ASSERT_EQUAL(search_server.FindTopDocuments("curly rat"s).size(), 1u);
+    ASSERT_EQUAL(search_server.FindTopDocuments(execution::par, "curly rat"s, DocumentStatus::BANNED).size(), 2u);
+    ASSERT(get<1>(search_server.MatchDocument("curly"s, 2)) == DocumentStatus::BANNED);
+    // Predicates see the new status too
+    const auto banned = search_server.FindTopDocuments("curly rat"s, [](int document_id, DocumentStatus status, int rating) {
+        return status == DocumentStatus::BANNED;
+        });
+    ASSERT_EQUAL(banned.size(), 2u);
+
+    search_server.SetDocumentStatus(3, DocumentStatus::ACTUAL);
+    search_server.RemoveDocument(1);
+    ASSERT_EQUAL(search_server.FindTopDocuments("curly rat"s).front().id, 3);
+    ASSERT(search_server.FindTopDocuments("curly rat"s, DocumentStatus::IRRELEVANT).empty());
+    try {
+        search_server.SetDocumentStatus(1, DocumentStatus::ACTUAL);
+        ASSERT_HINT(false, "out_of_range expected"s);
+    }
+    catch (const out_of_range&) {
+    }
+}
+
+void TestMaxScoreEngine() {
+    SearchServer search_server("and with"s);
+    mt19937 generator(11);
+    // Word frequencies fall off like in real texts, "and" and "every" are in all documents
+    vector<string> words;
+    for (int i = 0; i < 300; ++i) {
+        words.push_back("w"s + to_string(i));
+    }
+    for (int id = 0; id < 3000; ++id) {
+        string text = "every"s;
+        const int word_count = uniform_int_distribution(1, 12)(generator);
+        for (int i = 0; i < word_count; ++i) {
+            const double rank = exp(uniform_real_distribution(0.0, log(300.0))(generator)) - 1;
+            text += " "s + words[static_cast<size_t>(rank)] + " and"s;
+        }
+        search_server.AddDocument(id * 3, text, static_cast<DocumentStatus>(id % 4), { id % 5 });
+    }
+    search_server.RemoveDocument(30);
+    search_server.SetDocumentStatus(33, DocumentStatus::ACTUAL);
+
+    const auto assert_same = [](const vector<Document>& found, const vector<Document>& expected) {
+        ASSERT_EQUAL(found.size(), expected.size());
+        for (size_t i = 0; i < found.size(); ++i) {
+            ASSERT_EQUAL(found[i].id, expected[i].id);
+            ASSERT_EQUAL(found[i].relevance, expected[i].relevance);
+            ASSERT_EQUAL(found[i].rating, expected[i].rating);
+        }
+    };
+    const auto odd_rating = [](int document_id, DocumentStatus status, int rating) {
+        return rating % 2 == 1;
+    };
+    for (const int max_count : { 5, 1, 40, 5000 }) {
+        search_server.SetMaxResultDocumentCount(max_count);
+        for (int i = 0; i < 200; ++i) {
+            string query = i % 10 == 0 ? "every"s : ""s;
+            const int word_count = uniform_int_distribution(1, 6)(generator);
+            for (int j = 0; j < word_count; ++j) {
+                query += (query.empty() ? ""s : " "s) + (j == 3 ? "-"s : ""s) + words[generator() % (i % 2 == 0 ? 20 : words.size())];
+            }
+            assert_same(search_server.FindTopDocuments(query_engine::max_score, query), search_server.FindTopDocuments(query));
+            assert_same(search_server.FindTopDocuments(query_engine::max_score, query, DocumentStatus::BANNED),
+                search_server.FindTopDocuments(query, DocumentStatus::BANNED));
+            assert_same(search_server.FindTopDocuments(query_engine::max_score, query, odd_rating), search_server.FindTopDocuments(query, odd_rating));
+        }
+    }
+    ASSERT(search_server.FindTopDocuments(query_engine::max_score, "missing -every"s).empty());
+    ASSERT(search_server.FindTopDocuments(query_engine::max_score, "w1 -every"s).empty());
+    try {
+        search_server.FindTopDocuments(query_engine::max_score, "w1 --w2"s);
+        ASSERT_HINT(false, "invalid_argument expected"s);
+    }
+    catch (const invalid_argument&) {
+    }
+}
+
+void TestConcurrentSearchServer() {
+    SearchServer initial("and with"s);
+    initial.AddDocument(0, "white cat"s, DocumentStatus::ACTUAL, { 1 });
+    ConcurrentSearchServer search_server(initial);
+    const auto first_snapshot = search_server.GetSnapshot();
+
+    // Every update adds a pair of documents, so a consistent snapshot has an odd number of them
+    atomic<bool> is_done = false;
+    vector<thread> readers;
+    for (int i = 0; i < 3; ++i) {
+        readers.emplace_back([&]() {
+            while (!is_done) {
+                const auto snapshot = search_server.GetSnapshot();
+                const int document_count = snapshot->GetDocumentCount();
+                ASSERT_EQUAL(document_count % 2, 1);
+                ASSERT_EQUAL(snapshot->FindTopDocuments("pair"s).size(), min<size_t>(document_count / 2, MAX_RESULT_DOCUMENT_COUNT));
+                ASSERT_EQUAL(search_server.FindTopDocuments(execution::par, "white cat"s).size(), 1u);
+            }
+            });
+    }
+    SearchServer expected(initial);
+    for (int id = 1; id < 400; id += 2) {
+        search_server.Update([id](SearchServer& server) {
+            server.AddDocument(id, "pair "s + to_string(id), DocumentStatus::ACTUAL, { id });
+            server.AddDocument(id + 1, "fluffy dog "s + to_string(id), DocumentStatus::ACTUAL, { id });
+            });
+        expected.AddDocument(id, "pair "s + to_string(id), DocumentStatus::ACTUAL, { id });
+        expected.AddDocument(id + 1, "fluffy dog "s + to_string(id), DocumentStatus::ACTUAL, { id });
+    }
+    is_done = true;
+    for (thread& reader : readers) {
+        reader.join();
+    }
+
+    search_server.AddDocuments(vector<DocumentInput>{ { 1000, "pair dog"s, DocumentStatus::BANNED, { 5 } } });
+    search_server.SetDocumentStatus(1, DocumentStatus::IRRELEVANT);
+    search_server.RemoveDocument(2);
+    expected.AddDocuments(vector<DocumentInput>{ { 1000, "pair dog"s, DocumentStatus::BANNED, { 5 } } });
+    expected.SetDocumentStatus(1, DocumentStatus::IRRELEVANT);
+    expected.RemoveDocument(2);
+    // A failed change publishes nothing
+    try {
+        search_server.AddDocument(3, "pair"s, DocumentStatus::ACTUAL, {});
+        ASSERT_HINT(false, "invalid_argument expected"s);
+    }
+    catch (const invalid_argument&) {
+    }
+    ASSERT_EQUAL(search_server.GetVersion(), 203u);
+
+    // Replayed versions end up equal to the one that was copied
+    for (int i = 0; i < 3; ++i) {
+        search_server.AddDocument(2000 + i, "fluffy pair"s, DocumentStatus::ACTUAL, { i });
+        expected.AddDocument(2000 + i, "fluffy pair"s, DocumentStatus::ACTUAL, { i });
+        for (const string query : { "pair -dog"s, "fluffy dog"s, "pair 7"s }) {
+            for (const auto status : { DocumentStatus::ACTUAL, DocumentStatus::BANNED, DocumentStatus::IRRELEVANT }) {
+                const auto found = search_server.FindTopDocuments(query, status);
+                const auto expected_documents = expected.FindTopDocuments(query, status);
+                ASSERT_EQUAL(found.size(), expected_documents.size());
+                for (size_t j = 0; j < found.size(); ++j) {
+                    ASSERT_EQUAL(found[j].id, expected_documents[j].id);
+                    ASSERT_EQUAL(found[j].relevance, expected_documents[j].relevance);
+                }
+            }
+        }
+    }
+    ASSERT_EQUAL(search_server.GetDocumentCount(), expected.GetDocumentCount());
+    ASSERT(search_server.GetUpdateStats().reused_versions > 0);
+    // An old snapshot is not affected by later changes
+    ASSERT_EQUAL(first_snapshot->GetDocumentCount(), 1);
+    ASSERT(first_snapshot->FindTopDocuments("pair"s).empty());
+}
+
+void TestShardedSearchServer() {
+    SearchServer single("and with"s);
+    ShardedSearchServer sharded("and with"s, 4);
+    ASSERT_EQUAL(sharded.GetShardCount(), 4u);
+    mt19937 generator(13);
+    const vector<string> words = { "funny"s, "pet"s, "nasty"s, "rat"s, "curly"s, "hair"s, "not"s, "very"s, "and"s, "dog"s };
+    for (int i = 0; i < 2000; ++i) {
+        const int id = i * 7 + static_cast<int>(generator() % 5);
+        string text;
+        for (int j = uniform_int_distribution(1, 8)(generator); j > 0; --j) {
+            text += words[generator() % words.size()] + " "s + to_string(generator() % 50) + " "s;
+        }
+        single.AddDocument(id, text, static_cast<DocumentStatus>(i % 3), { i % 11 });
+        sharded.AddDocument(id, text, static_cast<DocumentStatus>(i % 3), { i % 11 });
+    }
+    for (int id = 0; id < 1000; id += 13) {
+        single.RemoveDocument(id);
+        sharded.RemoveDocument(id);
+    }
+    ASSERT_EQUAL(sharded.GetDocumentCount(), single.GetDocumentCount());
+    // Every shard got a part of the documents
+    int shard_document_count = 0;
+    for (size_t index = 0; index < sharded.GetShardCount(); ++index) {
+        ASSERT(sharded.GetShard(index).GetDocumentCount() > 0);
+        ASSERT(sharded.GetShard(index).GetDocumentCount() < single.GetDocumentCount());
+        shard_document_count += sharded.GetShard(index).GetDocumentCount();
+    }
+    ASSERT_EQUAL(shard_document_count, sharded.GetDocumentCount());
+
+    const auto assert_same = [](const vector<Document>& found, const vector<Document>& expected) {
+        ASSERT_EQUAL(found.size(), expected.size());
+        for (size_t i = 0; i < found.size(); ++i) {
+            ASSERT_EQUAL(found[i].id, expected[i].id);
+            ASSERT_EQUAL(found[i].relevance, expected[i].relevance);
+            ASSERT_EQUAL(found[i].rating, expected[i].rating);
+        }
+    };
+    const auto even_id = [](int document_id, DocumentStatus status, int rating) {
+        return document_id % 2 == 0;
+    };
+    for (const int max_count : { 5, 50 }) {
+        single.SetMaxResultDocumentCount(max_count);
+        sharded.SetMaxResultDocumentCount(max_count);
+        for (const string query : { "funny 7 rat"s, "curly hair -nasty -3"s, "very dog 10 11 12 -pet"s, "and"s, "missing -funny"s }) {
+            assert_same(sharded.FindTopDocuments(query), single.FindTopDocuments(query));
+            assert_same(sharded.FindTopDocuments(query, DocumentStatus::BANNED), single.FindTopDocuments(query, DocumentStatus::BANNED));
+            assert_same(sharded.FindTopDocuments(query, even_id), single.FindTopDocuments(query, even_id));
+            assert_same(sharded.FindTopDocuments(query_engine::max_score, query), single.FindTopDocuments(query));
+        }
+    }
+    for (int index = 0; index < 100; ++index) {
+        const int document_id = sharded.GetDocumentId(index);
+        ASSERT_EQUAL(document_id, single.GetDocumentId(index));
+        const auto [words, status] = sharded.MatchDocument("funny curly 5 -rat"s, document_id);
+        const auto [expected_words, expected_status] = single.MatchDocument("funny curly 5 -rat"s, document_id);
+        ASSERT(words == expected_words);
+        ASSERT(status == expected_status);
+    }
+    try {
+        sharded.AddDocument(sharded.GetDocumentId(0), "funny pet"s, DocumentStatus::ACTUAL, {});
+        ASSERT_HINT(false, "invalid_argument expected"s);
+    }
+    catch (const invalid_argument&) {
+    }
+    try {
+        ShardedSearchServer empty("and"s, 0);
+        ASSERT_HINT(false, "invalid_argument expected"s);
+    }
+    catch (const invalid_argument&) {
+    }
+}
+
+void TestQueryExecutor() {
+    SearchServer search_server("and with"s);
+    mt19937 generator(17);
+    const vector<string> words = { "funny"s, "pet"s, "nasty"s, "rat"s, "curly"s, "hair"s, "not"s, "very"s };
+    for (int id = 0; id < 500; ++id) {
+        string text;
+        for (int i = 0; i < 6; ++i) {
+            text += words[generator() % words.size()] + " "s;
+        }
+        search_server.AddDocument(id, text + to_string(id % 10), static_cast<DocumentStatus>(id % 2), { id % 7 });
+    }
+    vector<string> queries;
+    for (int i = 0; i < 200; ++i) {
+        queries.push_back(words[generator() % words.size()] + " "s + words[generator() % words.size()] + " -"s + to_string(i % 10));
+    }
+
+    {
+        // Batches of several clients at once
+        QueryExecutor executor(search_server, 3, 16);
+        vector<thread> clients;
+        for (int i = 0; i < 4; ++i) {
+            clients.emplace_back([&]() {
+                const auto results = executor.ProcessQueries(queries);
+                ASSERT_EQUAL(results.size(), queries.size());
+                for (size_t j = 0; j < queries.size(); ++j) {
+                    const auto expected = search_server.FindTopDocuments(queries[j]);
+                    ASSERT_EQUAL(results[j].size(), expected.size());
+                    for (size_t k = 0; k < expected.size(); ++k) {
+                        ASSERT_EQUAL(results[j][k].id, expected[k].id);
+                    }
+                }
+                });
+        }
+        for (thread& client : clients) {
+            client.join();
+        }
+        ASSERT_EQUAL(executor.Submit("curly"s, DocumentStatus::IRRELEVANT).Get().size(),
+            search_server.FindTopDocuments("curly"s, DocumentStatus::IRRELEVANT).size());
+        try {
+            executor.Submit("curly --hair"s).Get();
+            ASSERT_HINT(false, "invalid_argument expected"s);
+        }
+        catch (const invalid_argument&) {
+        }
+    }
+
+    {
+        // Tasks of a client run in the order they were submitted
+        vector<int> order;
+        promise<void> start;
+        shared_future<void> started = start.get_future().share();
+        {
+            WorkStealingThreadPool pool(1, 16);
+            pool.Submit([started]() {
+                started.wait();
+                });
+            for (int i = 0; i < 8; ++i) {
+                pool.Submit([&order, i]() {
+                    order.push_back(i);
+                    });
+            }
+            start.set_value();
+        }
+        ASSERT(order == vector<int>({ 0, 1, 2, 3, 4, 5, 6, 7 }));
+    }
+
+    // One thread held by a query that waits for a signal, so the queue fills up
+    QueryExecutor executor(search_server, 1, 2);
+    promise<void> release;
+    shared_future<void> released = release.get_future().share();
+    atomic<bool> is_blocked = false;
+    auto blocking = executor.Submit("funny"s, [released, &is_blocked](int document_id, DocumentStatus status, int rating) {
+        is_blocked = true;
+        released.wait();
+        return true;
+        });
+    while (!is_blocked) {
+        this_thread::yield();
+    }
+    auto first = executor.TrySubmit("pet"s);
+    auto second = executor.TrySubmit("rat"s);
+    ASSERT(first.has_value() && second.has_value());
+    ASSERT_EQUAL(executor.GetQueuedQueryCount(), 2u);
+    ASSERT(!executor.TrySubmit("hair"s).has_value());
+    ASSERT(first->Cancel());
+    // The cancelled query gives up its place at once
+    ASSERT_EQUAL(executor.GetQueuedQueryCount(), 1u);
+    auto third = executor.TrySubmit("hair"s);
+    ASSERT(third.has_value());
+    ASSERT(!executor.TrySubmit("curly"s).has_value());
+    release.set_value();
+    ASSERT(!blocking.Get().empty());
+    try {
+        first->Get();
+        ASSERT_HINT(false, "QueryCancelledError expected"s);
+    }
+    catch (const QueryCancelledError&) {
+    }
+    ASSERT_EQUAL(second->Get().size(), search_server.FindTopDocuments("rat"s).size());
+    ASSERT(!second->Cancel());
+    ASSERT_EQUAL(third->Get().size(), search_server.FindTopDocuments("hair"s).size());
+    ASSERT_EQUAL(executor.GetQueuedQueryCount(), 0u);
+}
+
+void TestProfiler() {
+    using profiling::LatencyHistogram;
+    // Buckets follow the values in order
+    for (const uint64_t value : vector<uint64_t>{ 0, 1, 7, 8, 9, 15, 16, 100, 1000, 123456789, numeric_limits<uint64_t>::max() }) {
+        const size_t bucket = LatencyHistogram::GetBucket(value);
+        ASSERT(bucket < LatencyHistogram::BUCKET_COUNT);
+        ASSERT(value <= LatencyHistogram::GetBucketUpperBound(bucket));
+        ASSERT(bucket == 0 || value > LatencyHistogram::GetBucketUpperBound(bucket - 1));
+    }
+
+    // Nested scopes of two threads are merged by path
+    const auto run = [](int inner_count) {
+        profiling::ProfileScope outer("TestProfiler"sv);
+        for (int i = 0; i < inner_count; ++i) {
+            profiling::ProfileScope inner("inner"sv);
+            profiling::ProfileScope innermost("innermost"sv);
+        }
+    };
+    run(3);
+    thread other(run, 5);
+    other.join();
+
+    const auto report = profiling::GetProfileReport();
+    const auto find_entry = [&report](string_view path) {
+        const auto it = find_if(report.begin(), report.end(), [path](const auto& entry) {
+            return entry.path == path;
+            });
+        ASSERT_HINT(it != report.end(), string(path));
+        return *it;
+    };
+    const auto outer = find_entry("TestProfiler"sv);
+    const auto inner = find_entry("TestProfiler/inner"sv);
+    const auto innermost = find_entry("TestProfiler/inner/innermost"sv);
+    ASSERT_EQUAL(outer.count, 2u);
+    ASSERT_EQUAL(inner.count, 8u);
+    ASSERT_EQUAL(innermost.count, 8u);
+    ASSERT_EQUAL(outer.depth, 0u);
+    ASSERT_EQUAL(innermost.depth, 2u);
+    for (const auto& entry : { outer, inner, innermost }) {
+        ASSERT(entry.p50_ns <= entry.p99_ns && entry.p99_ns <= entry.max_ns);
+        ASSERT(entry.mean_ns <= static_cast<double>(entry.max_ns));
+    }
+    ASSERT(inner.max_ns <= outer.max_ns);
+}
+
+void TestQueryStats() {
+    SearchServer search_server("and with"s);
+    search_server.AddDocument(1, "white cat with fashionable collar"s, DocumentStatus::ACTUAL, { 8, -3 });
+    search_server.AddDocument(2, "fluffy cat fluffy tail"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    search_server.AddDocument(3, "groomed dog expressive eyes"s, DocumentStatus::ACTUAL, { 5, -12, 2, 1 });
+    search_server.AddDocument(4, "groomed starling eugene"s, DocumentStatus::BANNED, { 9 });
+    search_server.EnableResultCache(16, 1 << 16);
+    const string query = "fluffy groomed cat cat -collar and"s;
+    search_server.FindTopDocuments(query);
+
+    // cat: 1, 2; fluffy: 2; groomed: 3, 4; the posting of document 1 is skipped for its minus word
+    QueryStats stats;
+    const auto documents = search_server.FindTopDocuments(query, stats);
+    const auto expected = search_server.FindTopDocuments(query);
+    ASSERT_EQUAL(documents.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        ASSERT_EQUAL(documents[i].id, expected[i].id);
+        ASSERT_EQUAL(documents[i].relevance, expected[i].relevance);
+    }
+    ASSERT_EQUAL(stats.plus_word_count, 3u);
+    ASSERT_EQUAL(stats.minus_word_count, 1u);
+    ASSERT_EQUAL(stats.postings_walked, 5u);
+    ASSERT_EQUAL(stats.minus_word_exclusions, 1u);
+    ASSERT_EQUAL(stats.predicate_calls, 4u);
+    ASSERT_EQUAL(stats.accumulator_size, 2u);
+    ASSERT(stats.GetTotalTime() == stats.parse_time + stats.minus_words_time + stats.score_time + stats.top_documents_time);
+    ASSERT(stats.score_time.count() > 0);
+
+    // The stats are reset by every call
+    search_server.FindTopDocuments(query, [](int document_id, DocumentStatus status, int rating) {
+        return document_id != 3;
+        }, stats);
+    ASSERT_EQUAL(stats.predicate_calls, 4u);
+    ASSERT_EQUAL(stats.accumulator_size, 2u);
+    ASSERT_EQUAL(search_server.FindTopDocuments(query, DocumentStatus::BANNED, stats).size(), 1u);
+    ASSERT_EQUAL(stats.accumulator_size, 1u);
+
+    const auto [words, status] = search_server.MatchDocument(query, 1, stats);
+    ASSERT(words.empty());
+    ASSERT_EQUAL(stats.minus_word_exclusions, 1u);
+    ASSERT_EQUAL(stats.postings_walked, 3u);
+    ASSERT_EQUAL(stats.predicate_calls, 0u);
+    const auto [matched_words, matched_status] = search_server.MatchDocument("fluffy cat"s, 2, stats);
+    ASSERT_EQUAL(matched_words.size(), 2u);
+    ASSERT_EQUAL(stats.minus_word_exclusions, 0u);
+}
+
+void TestPagination() {
+    SearchServer search_server("and"s);
+    mt19937 generator(5);
+    const vector<string> words = { "cat"s, "dog"s, "tail"s, "collar"s, "eyes"s, "fluffy"s };
+    for (int id = 0; id < 120; ++id) {
+        string text;
+        for (int i = uniform_int_distribution(1, 5)(generator); i > 0; --i) {
+            text += words[uniform_int_distribution<size_t>(0, words.size() - 1)(generator)] + " and "s;
+        }
+        // Few distinct ratings and texts, so many documents tie on relevance and rating
+        const auto status = id % 10 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        search_server.AddDocument(id, text, status, { uniform_int_distribution(0, 2)(generator) });
+    }
+    search_server.SetMaxResultDocumentCount(1000);
+
+    const auto check_pages = [&search_server](const vector<Document>& expected, size_t page_size, auto find_page) {
+        vector<Document> paged;
+        optional<SearchCursor> cursor;
+        size_t page_count = 0;
+        do {
+            const SearchPage page = find_page(page_size, cursor);
+            ASSERT(page.documents.size() <= page_size);
+            ASSERT(page.next_page.has_value() == (page.documents.size() == page_size && paged.size() + page_size < expected.size()));
+            paged.insert(paged.end(), page.documents.begin(), page.documents.end());
+            cursor = page.next_page;
+            ++page_count;
+        } while (cursor.has_value());
+        ASSERT_EQUAL(page_count, max<size_t>((expected.size() + page_size - 1) / page_size, 1));
+        ASSERT_EQUAL(paged.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            ASSERT_EQUAL(paged[i].id, expected[i].id);
+            ASSERT_EQUAL(paged[i].relevance, expected[i].relevance);
+        }
+    };
+    const string query = "fluffy cat -collar"s;
+    for (const size_t page_size : { 1u, 7u, 25u, 500u }) {
+        check_pages(search_server.FindTopDocuments(query), page_size, [&](size_t size, const optional<SearchCursor>& cursor) {
+            return search_server.FindTopDocumentsPage(query, size, cursor);
+            });
+        check_pages(search_server.FindTopDocuments(query, DocumentStatus::BANNED), page_size, [&](size_t size, const optional<SearchCursor>& cursor) {
+            return search_server.FindTopDocumentsPage(query, DocumentStatus::BANNED, size, cursor);
+            });
+        const auto is_even = [](int document_id, DocumentStatus status, int rating) {
+            return document_id % 2 == 0;
+        };
+        check_pages(search_server.FindTopDocuments(query, is_even), page_size, [&](size_t size, const optional<SearchCursor>& cursor) {
+            return search_server.FindTopDocumentsPage(query, is_even, size, cursor);
+            });
+    }
+    ASSERT(search_server.FindTopDocumentsPage("parrot"s, 3).documents.empty());
+    try {
+        search_server.FindTopDocumentsPage(query, 0);
+        ASSERT_HINT(false, "invalid_argument expected"s);
+    }
+    catch (const invalid_argument&) {
+    }
+
+    // Pages of Paginator are made on the fly
+    const vector<int> numbers = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    const auto pages = Paginate(numbers, 3);
+    ASSERT_EQUAL(pages.size(), 4u);
+    vector<size_t> page_sizes;
+    vector<int> paged_numbers;
+    for (const auto page : pages) {
+        page_sizes.push_back(page.size());
+        paged_numbers.insert(paged_numbers.end(), page.begin(), page.end());
+    }
+    ASSERT(page_sizes == vector<size_t>({ 3, 3, 3, 1 }));
+    ASSERT(paged_numbers == numbers);
+    ASSERT_EQUAL(*(*next(pages.begin(), 3)).begin(), 10);
+    using PageIterator = decltype(pages.begin());
+    static_assert(forward_iterator<PageIterator>);
+    static_assert(is_same_v<iterator_traits<PageIterator>::iterator_category, input_iterator_tag>);
+    ASSERT_EQUAL(ranges::distance(pages.begin(), pages.end()), 4);
+    const vector<int> no_numbers;
+    ASSERT_EQUAL(Paginate(no_numbers, 2).size(), 0u);
+    ASSERT(Paginate(no_numbers, 2).begin() == Paginate(no_numbers, 2).end());
+    try {
+        Paginate(numbers, 0);
+        ASSERT_HINT(false, "invalid_argument expected"s);
+    }
+    catch (const invalid_argument&) {
+    }
+}
+
+void TestPhraseQueries() {
+    const auto get_ids = [](const vector<Document>& documents) {
+        set<int> ids;
+        for (const Document& document : documents) {
+            ids.insert(document.id);
+        }
+        return ids;
+    };
+    const auto expect_invalid = [](const auto& search) {
+        try {
+            search();
+            ASSERT_HINT(false, "invalid_argument expected"s);
+        }
+        catch (const invalid_argument&) {
+        }
+    };
+
+    SearchServer search_server("and in the"s);
+    search_server.EnablePositionalIndex();
+    ASSERT(search_server.HasPositionalIndex());
+    search_server.AddDocument(1, "curly hair and curly tail"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(2, "hair curly"s, DocumentStatus::ACTUAL, { 2 });
+    search_server.AddDocument(3, "curly the hair"s, DocumentStatus::ACTUAL, { 3 });
+    search_server.AddDocument(4, "curly dog with hair"s, DocumentStatus::ACTUAL, { 4 });
+    search_server.AddDocument(5, "big curly hair cat"s, DocumentStatus::ACTUAL, { 5 });
+    expect_invalid([&]() { search_server.EnablePositionalIndex(); });
+
+    // Stop words between phrase words are skipped like in the documents
+    ASSERT(get_ids(search_server.FindTopDocuments("\"curly hair\""s)) == set<int>({ 1, 3, 5 }));
+    ASSERT(get_ids(search_server.FindTopDocuments("\"curly and hair\""s)) == set<int>({ 1, 3, 5 }));
+    ASSERT(get_ids(search_server.FindTopDocuments("\"hair curly\""s)) == set<int>({ 1, 2 }));
+    ASSERT(get_ids(search_server.FindTopDocuments("\"curly hair\" cat"s)) == set<int>({ 1, 3, 5 }));
+    ASSERT(get_ids(search_server.FindTopDocuments("\"curly hair\" -cat"s)) == set<int>({ 1, 3 }));
+    ASSERT(get_ids(search_server.FindTopDocuments("\"curly hair\" \"curly tail\""s)) == set<int>({ 1 }));
+    ASSERT(get_ids(search_server.FindTopDocuments("\"curly\""s)) == set<int>({ 1, 2, 3, 4, 5 }));
+    ASSERT(search_server.FindTopDocuments("\"curly parrot\""s).empty());
+    ASSERT(search_server.FindTopDocuments(query_engine::max_score, "\"curly hair\" dog"s).size() == 3);
+    ASSERT(get_ids(search_server.FindTopDocuments(execution::par, "\"big curly\" dog"s)) == set<int>({ 5 }));
+
+    // Phrase words are scored as plus words
+    const auto plain = search_server.FindTopDocuments("curly hair"s);
+    for (const Document& document : search_server.FindTopDocuments("\"curly hair\""s)) {
+        const auto it = find_if(plain.begin(), plain.end(), [&document](const Document& other) { return other.id == document.id; });
+        ASSERT(it != plain.end());
+        ASSERT_EQUAL(it->relevance, document.relevance);
+    }
+
+    const auto [words, status] = search_server.MatchDocument("\"curly hair\""s, 4);
+    ASSERT(words.empty());
+    const auto [phrase_words, phrase_status] = search_server.MatchDocument("\"curly hair\""s, 5);
+    ASSERT_EQUAL(phrase_words.size(), 2u);
+
+    expect_invalid([&]() { search_server.FindTopDocuments("\"curly hair"s); });
+    expect_invalid([&]() { search_server.FindTopDocuments("curly hair\""s); });
+    expect_invalid([&]() { search_server.FindTopDocuments("\"curly -hair\""s); });
+    expect_invalid([&]() { search_server.FindTopDocuments("-\"curly hair\""s); });
+    expect_invalid([&]() { search_server.FindTopDocuments("\"curly \"hair\"\""s); });
+    expect_invalid([&]() { SearchServer("and"s).FindTopDocuments("\"curly hair\""s); });
+
+    // Phrases are part of cached queries
+    search_server.EnableResultCache(16, 1 << 16);
+    ASSERT_EQUAL(search_server.FindTopDocuments("curly hair"s).size(), 5u);
+    ASSERT_EQUAL(search_server.FindTopDocuments("\"curly hair\""s).size(), 3u);
+
+    // Positions follow removals, bulk loads and compaction
+    search_server.RemoveDocument(5);
+    search_server.RemoveDocument(execution::par, 4);
+    search_server.AddDocuments(vector<DocumentInput>{ { 7, "curly hair"s, DocumentStatus::ACTUAL, { 1 } },
+        { 6, "dog curly tail hair"s, DocumentStatus::ACTUAL, { 1 } } });
+    search_server.CompactTermStorage();
+    ASSERT(get_ids(search_server.FindTopDocuments("\"curly hair\""s)) == set<int>({ 1, 3, 7 }));
+    ASSERT(get_ids(search_server.FindTopDocuments("\"curly tail\""s)) == set<int>({ 1, 6 }));
+    ASSERT(search_server.FindTopDocuments("\"curly dog\""s).empty());
+
+    // Against a scan of the texts, with long document lists that skip pointers step over.
+    // Documents are bulk loaded out of id order
+    mt19937 generator(7);
+    const vector<string> vocabulary = { "a"s, "b"s, "c"s, "d"s, "the"s };
+    SearchServer random_server("the"s);
+    random_server.EnablePositionalIndex();
+    vector<DocumentInput> inputs;
+    vector<vector<string>> texts;
+    for (int id = 0; id < 3000; ++id) {
+        vector<string> words;
+        string text;
+        for (int i = uniform_int_distribution(1, 8)(generator); i > 0; --i) {
+            // "d" is rare, so it drives the intersections
+            const int roll = uniform_int_distribution(0, 99)(generator);
+            const string& word = roll < 2 ? vocabulary[3] : roll < 20 ? vocabulary[4] : vocabulary[roll % 3];
+            text += word + " "s;
+            if (word != "the"s) {
+                words.push_back(word);
+            }
+        }
+        inputs.push_back({ id, text, DocumentStatus::ACTUAL, { 0 } });
+        texts.push_back(move(words));
+    }
+    shuffle(inputs.begin(), inputs.end(), generator);
+    random_server.AddDocuments(vector<DocumentInput>(inputs.begin(), inputs.begin() + inputs.size() / 2));
+    random_server.AddDocuments(execution::seq, vector<DocumentInput>(inputs.begin() + inputs.size() / 2, inputs.end()));
+    random_server.SetMaxResultDocumentCount(10'000);
+    for (const vector<string> phrase : { vector<string>{ "a"s, "b"s }, { "d"s, "a"s }, { "a"s, "d"s, "c"s }, { "b"s, "b"s, "b"s } }) {
+        string query = "\""s;
+        for (const string& word : phrase) {
+            query += word + " "s;
+        }
+        query.back() = '"';
+        set<int> expected;
+        for (int id = 0; id < static_cast<int>(texts.size()); ++id) {
+            if (search(texts[id].begin(), texts[id].end(), phrase.begin(), phrase.end()) != texts[id].end()) {
+                expected.insert(id);
+            }
+        }
+        ASSERT(!expected.empty());
+        ASSERT_HINT(get_ids(random_server.FindTopDocuments(query)) == expected, query);
+        for (int id = 0; id < static_cast<int>(texts.size()); id += 7) {
+            ASSERT_EQUAL_HINT(get<0>(random_server.MatchDocument(query, id)).empty(), expected.count(id) == 0, query);
+        }
+    }
+}
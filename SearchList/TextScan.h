@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define TEXT_SCAN_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TEXT_SCAN_TARGET_AVX2
+#else
+#define TEXT_SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Byte scanning kernels of the tokenizer: spaces are found and control characters detected
+// 16 (SSE2) or 32 (AVX2) bytes at a time. The best instruction set of the running CPU is chosen on first use,
+// other processors and compilers get the portable byte loop.
+
+enum class TextScanIsa {
+    SCALAR,
+    SSE2,
+    AVX2,
+};
+
+struct TextScanKernels {
+    // Sets bit i % 64 of bits[i / 64] for every space at data[i]; all (size + 63) / 64 words are overwritten
+    void (*mark_spaces)(const char* data, size_t size, uint64_t* bits);
+    // Whether some byte is in 0..31
+    bool (*has_control_characters)(const char* data, size_t size);
+};
+
+namespace text_scan_detail {
+
+inline bool IsControlCharacter(char c) {
+    return static_cast<unsigned char>(c) < ' ';
+}
+
+inline void MarkSpacesScalar(const char* data, size_t size, uint64_t* bits) {
+    for (size_t word = 0; word * 64 < size; ++word) {
+        uint64_t mask = 0;
+        const size_t end = size - word * 64 < 64 ? size - word * 64 : 64;
+        for (size_t i = 0; i < end; ++i) {
+            mask |= static_cast<uint64_t>(data[word * 64 + i] == ' ') << i;
+        }
+        bits[word] = mask;
+    }
+}
+
+inline bool HasControlCharactersScalar(const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (IsControlCharacter(data[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef TEXT_SCAN_X86
+inline void MarkSpacesSse2(const char* data, size_t size, uint64_t* bits) {
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const size_t full_words = size / 64;
+    for (size_t word = 0; word < full_words; ++word) {
+        uint64_t mask = 0;
+        for (size_t chunk = 0; chunk < 4; ++chunk) {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + word * 64 + chunk * 16));
+            mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, spaces)))) << (chunk * 16);
+        }
+        bits[word] = mask;
+    }
+    MarkSpacesScalar(data + full_words * 64, size - full_words * 64, bits + full_words);
+}
+
+inline bool HasControlCharactersSse2(const char* data, size_t size) {
+    // A byte is at most 31 exactly when the unsigned minimum with 31 leaves it unchanged
+    const __m128i max_control = _mm_set1_epi8(' ' - 1);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(bytes, max_control), bytes)) != 0) {
+            return true;
+        }
+    }
+    return HasControlCharactersScalar(data + i, size - i);
+}
+
+TEXT_SCAN_TARGET_AVX2 inline void MarkSpacesAvx2(const char* data, size_t size, uint64_t* bits) {
+    const __m256i spaces = _mm256_set1_epi8(' ');
+    const size_t full_words = size / 64;
+    for (size_t word = 0; word < full_words; ++word) {
+        const __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + word * 64));
+        const __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + word * 64 + 32));
+        const auto low_mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, spaces)));
+        const auto high_mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, spaces)));
+        bits[word] = (static_cast<uint64_t>(high_mask) << 32) | low_mask;
+    }
+    MarkSpacesScalar(data + full_words * 64, size - full_words * 64, bits + full_words);
+}
+
+TEXT_SCAN_TARGET_AVX2 inline bool HasControlCharactersAvx2(const char* data, size_t size) {
+    const __m256i max_control = _mm256_set1_epi8(' ' - 1);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(bytes, max_control), bytes)) != 0) {
+            return true;
+        }
+    }
+    return HasControlCharactersSse2(data + i, size - i);
+}
+
+inline bool CpuSupportsAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+    const bool has_avx = (info[2] & (1 << 28)) != 0;
+    // The OS must save the upper halves of the YMM registers
+    if (!has_osxsave || !has_avx || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+}  // namespace text_scan_detail
+
+// The best instruction set the running CPU supports
+inline TextScanIsa GetBestTextScanIsa() {
+#ifdef TEXT_SCAN_X86
+    static const TextScanIsa best_isa = text_scan_detail::CpuSupportsAvx2() ? TextScanIsa::AVX2 : TextScanIsa::SSE2;
+    return best_isa;
+#else
+    return TextScanIsa::SCALAR;
+#endif
+}
+
+// Kernels of the given instruction set, which the CPU must support
+inline const TextScanKernels& GetTextScanKernels(TextScanIsa isa) {
+    using namespace text_scan_detail;
+    static const TextScanKernels scalar_kernels{ MarkSpacesScalar, HasControlCharactersScalar };
+#ifdef TEXT_SCAN_X86
+    static const TextScanKernels sse2_kernels{ MarkSpacesSse2, HasControlCharactersSse2 };
+    static const TextScanKernels avx2_kernels{ MarkSpacesAvx2, HasControlCharactersAvx2 };
+    if (isa == TextScanIsa::AVX2) {
+        return avx2_kernels;
+    }
+    if (isa == TextScanIsa::SSE2) {
+        return sse2_kernels;
+    }
+#endif
+    return scalar_kernels;
+}
+
+inline const TextScanKernels& GetTextScanKernels() {
+    static const TextScanKernels& best_kernels = GetTextScanKernels(GetBestTextScanIsa());
+    return best_kernels;
+}
+
+inline bool HasControlCharacters(std::string_view text) {
+    return GetTextScanKernels().has_control_characters(text.data(), text.size());
+}
@@ -1,8 +1,20 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #define PROFILE_CONCAT_INTERNAL(X, Y) X##Y
 #define PROFILE_CONCAT(X, Y) PROFILE_CONCAT_INTERNAL(X, Y)
@@ -46,6 +58,269 @@
   */
 #define LOG_DURATION_STREAM(x, y) LogDuration UNIQUE_VAR_NAME_PROFILE(x, y)
 
+// Profiling of nested scopes, see namespace profiling below. Without SEARCH_LIST_PROFILING defined
+// the macro expands to nothing and LOG_DURATION only prints its time
+#ifdef SEARCH_LIST_PROFILING
+#define PROFILE_SCOPE(x) profiling::ProfileScope UNIQUE_VAR_NAME_PROFILE(x)
+#else
+#define PROFILE_SCOPE(x)
+#endif
+
+namespace profiling {
+
+// Nanosecond latencies in 8 buckets per power of two, so percentiles are within 12.5%.
+// Only the owning thread records; others may read at any time, all counters being relaxed atomics
+class LatencyHistogram {
+public:
+    static constexpr size_t SUB_BUCKET_COUNT = 8;
+    static constexpr size_t BUCKET_COUNT = 64 * SUB_BUCKET_COUNT;
+
+    struct Snapshot {
+        std::array<uint64_t, BUCKET_COUNT> buckets{};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+
+        void Merge(const Snapshot& other) {
+            for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+                buckets[i] += other.buckets[i];
+            }
+            count += other.count;
+            sum += other.sum;
+            max = std::max(max, other.max);
+        }
+
+        // Upper bound of the bucket holding the value of rank ceil(p * count), capped by max
+        uint64_t GetPercentile(double p) const {
+            const auto rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(p * count)), 1);
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+                seen += buckets[i];
+                if (seen >= rank) {
+                    return std::min(GetBucketUpperBound(i), max);
+                }
+            }
+            return max;
+        }
+    };
+
+    static size_t GetBucket(uint64_t value) {
+        if (value < SUB_BUCKET_COUNT) {
+            return static_cast<size_t>(value);
+        }
+        const int exponent = std::bit_width(value) - 1;
+        const auto sub_bucket = static_cast<size_t>(value >> (exponent - 3)) & (SUB_BUCKET_COUNT - 1);
+        return (exponent - 2) * SUB_BUCKET_COUNT + sub_bucket;
+    }
+
+    static uint64_t GetBucketUpperBound(size_t bucket) {
+        if (bucket < SUB_BUCKET_COUNT) {
+            return bucket;
+        }
+        const int shift = static_cast<int>(bucket / SUB_BUCKET_COUNT) - 1;
+        const uint64_t lower = (SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << shift;
+        return lower + ((uint64_t{ 1 } << shift) - 1);
+    }
+
+    void Record(uint64_t nanoseconds) {
+        Increase(buckets_[GetBucket(nanoseconds)], 1);
+        Increase(count_, 1);
+        Increase(sum_, nanoseconds);
+        if (nanoseconds > max_.load(std::memory_order_relaxed)) {
+            max_.store(nanoseconds, std::memory_order_relaxed);
+        }
+    }
+
+    Snapshot GetSnapshot() const {
+        Snapshot snapshot;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        }
+        snapshot.count = count_.load(std::memory_order_relaxed);
+        snapshot.sum = sum_.load(std::memory_order_relaxed);
+        snapshot.max = max_.load(std::memory_order_relaxed);
+        return snapshot;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets_{};
+    std::atomic<uint64_t> count_ = 0;
+    std::atomic<uint64_t> sum_ = 0;
+    std::atomic<uint64_t> max_ = 0;
+
+    // A plain load and store: there is one writer, so no read-modify-write instruction is needed
+    static void Increase(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
+// Scope of a thread's call tree. Children are prepended to a list with a release store,
+// so readers walk the tree while the owner keeps adding to it. Nodes live as long as the program
+struct ProfileNode {
+    ProfileNode(std::string_view node_name, ProfileNode* parent_node)
+        : name(node_name)
+        , parent(parent_node) {
+    }
+
+    ~ProfileNode() {
+        delete first_child.load(std::memory_order_relaxed);
+        delete next_sibling.load(std::memory_order_relaxed);
+    }
+
+    // Called only by the owning thread
+    ProfileNode* GetChild(std::string_view child_name) {
+        ProfileNode* head = first_child.load(std::memory_order_relaxed);
+        for (ProfileNode* child = head; child != nullptr; child = child->next_sibling.load(std::memory_order_relaxed)) {
+            if (child->name == child_name) {
+                return child;
+            }
+        }
+        auto* child = new ProfileNode(child_name, this);
+        child->next_sibling.store(head, std::memory_order_relaxed);
+        first_child.store(child, std::memory_order_release);
+        return child;
+    }
+
+    const std::string name;
+    ProfileNode* const parent;
+    LatencyHistogram histogram;
+    std::atomic<ProfileNode*> first_child = nullptr;
+    std::atomic<ProfileNode*> next_sibling = nullptr;
+};
+
+// Profiles of all threads that ever entered a scope; kept after the threads exit
+class ProfileRegistry {
+public:
+    struct ThreadProfile {
+        ProfileNode root{ {}, nullptr };
+        ProfileNode* current = &root;  // innermost open scope, used only by the owning thread
+    };
+
+    static ProfileRegistry& GetInstance() {
+        static ProfileRegistry registry;
+        return registry;
+    }
+
+    static ThreadProfile& GetThreadProfile() {
+        thread_local ThreadProfile& profile = GetInstance().AddThreadProfile();
+        return profile;
+    }
+
+    template <typename Callback>
+    void ForEachThreadProfile(Callback callback) const {
+        std::lock_guard guard(mutex_);
+        for (const auto& profile : profiles_) {
+            callback(*profile);
+        }
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<ThreadProfile>> profiles_;
+
+    ThreadProfile& AddThreadProfile() {
+        std::lock_guard guard(mutex_);
+        return *profiles_.emplace_back(std::make_unique<ThreadProfile>());
+    }
+};
+
+// Records the time until the end of the block into the thread's node for the name under the enclosing scope
+class ProfileScope {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit ProfileScope(std::string_view name)
+        : profile_(ProfileRegistry::GetThreadProfile())
+        , node_(profile_.current->GetChild(name)) {
+        profile_.current = node_;
+        start_time_ = Clock::now();
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    ~ProfileScope() {
+        const auto duration = Clock::now() - start_time_;
+        node_->histogram.Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()));
+        profile_.current = node_->parent;
+    }
+
+private:
+    ProfileRegistry::ThreadProfile& profile_;
+    ProfileNode* node_;
+    Clock::time_point start_time_;
+};
+
+struct ProfileReportEntry {
+    std::string path;  // scope names from the outermost one, separated by '/'
+    size_t depth = 0;
+    uint64_t count = 0;
+    double mean_ns = 0.0;
+    uint64_t p50_ns = 0;
+    uint64_t p99_ns = 0;
+    uint64_t max_ns = 0;
+};
+
+// Scopes of all threads merged by path, parents before their children
+inline std::vector<ProfileReportEntry> GetProfileReport() {
+    std::vector<std::string> paths;
+    std::vector<size_t> depths;
+    std::map<std::string, LatencyHistogram::Snapshot> histograms;
+    ProfileRegistry::GetInstance().ForEachThreadProfile([&](const ProfileRegistry::ThreadProfile& profile) {
+        const auto visit = [&](const auto& self, const ProfileNode& node, const std::string& parent_path, size_t depth) -> void {
+            // The list is newest first, the report lists scopes in the order they were first entered
+            std::vector<const ProfileNode*> children;
+            for (const ProfileNode* child = node.first_child.load(std::memory_order_acquire); child != nullptr;
+                child = child->next_sibling.load(std::memory_order_acquire)) {
+                children.push_back(child);
+            }
+            for (auto child_it = children.rbegin(); child_it != children.rend(); ++child_it) {
+                const ProfileNode* child = *child_it;
+                const std::string path = parent_path.empty() ? child->name : parent_path + '/' + child->name;
+                const auto [it, is_new] = histograms.try_emplace(path);
+                if (is_new) {
+                    paths.push_back(path);
+                    depths.push_back(depth);
+                }
+                it->second.Merge(child->histogram.GetSnapshot());
+                self(self, *child, path, depth + 1);
+            }
+        };
+        visit(visit, profile.root, {}, 0);
+    });
+
+    std::vector<ProfileReportEntry> report;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        const auto& histogram = histograms.at(paths[i]);
+        ProfileReportEntry entry;
+        entry.path = paths[i];
+        entry.depth = depths[i];
+        entry.count = histogram.count;
+        entry.mean_ns = histogram.count == 0 ? 0.0 : static_cast<double>(histogram.sum) / histogram.count;
+        entry.p50_ns = histogram.GetPercentile(0.5);
+        entry.p99_ns = histogram.GetPercentile(0.99);
+        entry.max_ns = histogram.max;
+        report.push_back(std::move(entry));
+    }
+    return report;
+}
+
+// Scope names are indented by depth, times are in microseconds
+inline void PrintProfileReport(std::ostream& out) {
+    out << std::left << std::setw(40) << "scope" << std::right << std::setw(12) << "count" << std::setw(12) << "mean"
+        << std::setw(12) << "p50" << std::setw(12) << "p99" << std::setw(12) << "max" << '\n';
+    for (const ProfileReportEntry& entry : GetProfileReport()) {
+        const auto slash = entry.path.rfind('/');
+        const std::string name = std::string(entry.depth * 2, ' ') + entry.path.substr(slash == std::string::npos ? 0 : slash + 1);
+        out << std::left << std::setw(40) << name << std::right << std::setw(12) << entry.count << std::fixed << std::setprecision(1)
+            << std::setw(12) << entry.mean_ns / 1e3 << std::setw(12) << entry.p50_ns / 1e3
+            << std::setw(12) << entry.p99_ns / 1e3 << std::setw(12) << entry.max_ns / 1e3 << std::defaultfloat << '\n';
+    }
+    out.flush();
+}
+
+}  // namespace profiling
+
 class LogDuration {
 public:
     //    std::chrono::steady_clock
@@ -63,11 +338,15 @@ public:
 
         const auto end_time = Clock::now();
         const auto dur = end_time - start_time_;
-        dst_stream_ << id_ << ": "sv << duration_cast<milliseconds>(dur).count() << " ms"sv << std::endl;
+        // No flush: the stream's own buffering decides, so that logging does not stall the measured code
+        dst_stream_ << id_ << ": "sv << duration_cast<milliseconds>(dur).count() << " ms"sv << '\n';
     }
 
 private:
     const std::string id_;
+#ifdef SEARCH_LIST_PROFILING
+    profiling::ProfileScope profile_scope_{ id_ };  // the timed block also becomes a profiled scope
+#endif
     const Clock::time_point start_time_ = Clock::now();
     std::ostream& dst_stream_;
 };
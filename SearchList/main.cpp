@@ -7,6 +7,12 @@
 #include "SearchServer.h"
 #include "logtime.h"
 #include "Framework.h"
+#include "RemoveDuplicates.h"
+#include "RequestQueue.h"
+#include "MappedSearchServer.h"
+#include "ConcurrentSearchServer.h"
+#include "ShardedSearchServer.h"
+#include "QueryExecutor.h"
 #include "TestSearchServer.h"
 #include "ProcessQueries.h"
 #include "TestProcessQueries.h"
@@ -17,5 +23,28 @@ int main()
 {
     Test3();
     TestProcessQueriesJoined();
+    TestParallelFindTopDocuments();
+    TestMaxResultDocumentCount();
+    TestRemoveDocument();
+    TestRemoveDuplicates();
+    TestMatchDocumentWords();
+    TestCompactTermStorage();
+    TestInverseDocumentFreqCache();
+    TestResultCache();
+    TestRequestQueue();
+    TestAddDocuments();
+    TestMappedSearchServer();
+    TestCompressedPostings();
+    TestTextScan();
+    TestDocumentBitmap();
+    TestSetDocumentStatus();
+    TestMaxScoreEngine();
+    TestConcurrentSearchServer();
+    TestShardedSearchServer();
+    TestQueryExecutor();
+    TestProfiler();
+    TestQueryStats();
+    TestPagination();
+    TestPhraseQueries();
     return 0;
 }
\ No newline at end of file